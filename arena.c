@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define CHUNKSIZE   4096     /* smallest chunk the arena asks for */
+#define ALIGN       sizeof(void *)
+#define KEEPMAX     (1 << 20) /* biggest chunk arena_reset keeps */
+
+/*
+ * newchunk - Put a chunk with room for at least n bytes at the head,
+ *    moving the object under construction (if any) into it
+ */
+static void newchunk(struct arena *a, size_t n)
+{
+  struct arena_chunk *c;
+  size_t size = CHUNKSIZE;
+
+  n += a->objlen;
+  if (a->head != NULL && a->head->size * 2 > size)
+    size = a->head->size * 2;
+  while (size < n)
+    size *= 2;
+
+  c = malloc(sizeof(*c) + size);
+  if (c == NULL) {
+    fprintf(stdout, "arena: out of memory\n");
+    exit(1);
+  }
+  a->nalloc++;
+  c->size = size;
+  c->used = 0;
+  if (a->objlen > 0)
+    memcpy(c->data, a->head->data + a->head->used, a->objlen);
+  c->next = a->head;
+  a->head = c;
+}
+
+/* arena_init - Start an empty arena */
+void arena_init(struct arena *a)
+{
+  a->head = NULL;
+  a->objlen = 0;
+  a->nalloc = 0;
+}
+
+/*
+ * arena_alloc - n bytes of pointer-aligned memory, valid until the
+ *    next arena_reset. Must not be called while an object is growing.
+ */
+void *arena_alloc(struct arena *a, size_t n)
+{
+  void *p;
+
+  if (a->head != NULL)
+    a->head->used = (a->head->used + ALIGN - 1) & ~(ALIGN - 1);
+  if (a->head == NULL || a->head->size - a->head->used < n)
+    newchunk(a, n);
+  p = a->head->data + a->head->used;
+  a->head->used += n;
+  return p;
+}
+
+/*
+ * arena_grow - Append a byte to the object under construction. The
+ *    object stays contiguous; it moves if the chunk fills up.
+ */
+void arena_grow(struct arena *a, int c)
+{
+  if (a->head == NULL || a->head->size - a->head->used - a->objlen < 1)
+    newchunk(a, 1);
+  a->head->data[a->head->used + a->objlen++] = c;
+}
+
+/*
+ * arena_room - Make room for n more bytes of the object under
+ *    construction and return where they go. The chunk grows
+ *    geometrically, so filling it this way costs linear time.
+ */
+char *arena_room(struct arena *a, size_t n)
+{
+  if (a->head == NULL || a->head->size - a->head->used - a->objlen < n)
+    newchunk(a, n);
+  return a->head->data + a->head->used + a->objlen;
+}
+
+/* arena_grew - Add the n bytes written at arena_room to the object */
+void arena_grew(struct arena *a, size_t n)
+{
+  a->objlen += n;
+}
+
+/* arena_finish - Close the object under construction and return it */
+char *arena_finish(struct arena *a)
+{
+  char *p;
+
+  if (a->head == NULL)
+    newchunk(a, 0);
+  p = a->head->data + a->head->used;
+  a->head->used += a->objlen;
+  a->objlen = 0;
+  return p;
+}
+
+/*
+ * arena_split - Close the first n bytes of the object under
+ *    construction and return them; the rest goes on growing
+ */
+char *arena_split(struct arena *a, size_t n)
+{
+  char *p = arena_room(a, 0);
+
+  p -= a->objlen;
+  a->head->used += n;
+  a->objlen -= n;
+  return p;
+}
+
+/* arena_reset - Release everything, keeping the newest chunk unless it is huge */
+void arena_reset(struct arena *a)
+{
+  struct arena_chunk *c, *next;
+
+  if (a->head == NULL)
+    return;
+  if (a->head->size > KEEPMAX) {
+    arena_free(a);
+    return;
+  }
+  for (c = a->head->next; c != NULL; c = next) {
+    next = c->next;
+    free(c);
+  }
+  a->head->next = NULL;
+  a->head->used = 0;
+  a->objlen = 0;
+}
+
+/* arena_free - Release everything, including the last chunk */
+void arena_free(struct arena *a)
+{
+  struct arena_chunk *c, *next;
+
+  for (c = a->head; c != NULL; c = next) {
+    next = c->next;
+    free(c);
+  }
+  a->head = NULL;
+  a->objlen = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef FILE_ARENA
+#define FILE_ARENA
+
+#include <stddef.h>
+
+/*
+ * A bump allocator for everything that lives as long as one command
+ * line: it is filled while the line is tokenized and parsed, and
+ * released in one step by arena_reset. The biggest chunk is kept for
+ * the next line (unless it is huge), so a warmed-up shell does no
+ * malloc per line.
+ *
+ * One object at a time can be grown at the end, a byte at a time with
+ * arena_grow, or by writing up to n bytes at arena_room and passing
+ * arena_grew the count, which is how read() fills it directly.
+ */
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;              /* bytes in data */
+  size_t used;
+  char data[];
+};
+
+struct arena {
+  struct arena_chunk *head; /* the chunk being filled */
+  size_t objlen;            /* bytes of the object being grown */
+  long nalloc;              /* chunks malloc'd so far, for benchmarks */
+};
+
+void arena_init(struct arena *a);
+void *arena_alloc(struct arena *a, size_t n);
+void arena_grow(struct arena *a, int c);
+char *arena_room(struct arena *a, size_t n);
+void arena_grew(struct arena *a, size_t n);
+char *arena_finish(struct arena *a);
+char *arena_split(struct arena *a, size_t n);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+#endif
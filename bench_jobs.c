@@ -0,0 +1,79 @@
+/*
+ * bench_jobs.c - Benchmark for the shell's job list
+ *
+ * usage: bench_jobs [n]
+ * Adds n jobs (default 100000) with scattered pids, looks each one up
+ * by pid and by jid, then reaps them in a different order than they
+ * were added, and reports the cost per operation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "jobs.h"
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t pidof(int i)
+{
+  /* spread the pids out the way a busy host hands them out */
+  return (pid_t)(1 + ((unsigned)i * 7919u) % 4000000u);
+}
+
+static void report(const char *what, int n, double secs)
+{
+  printf("%-8s %8d ops %10.1f ns/op\n", what, n, secs * 1e9 / n);
+}
+
+int main(int argc, char **argv)
+{
+  struct joblist jobs;
+  struct job_t *job;
+  int i, n, misses = 0;
+  double t;
+
+  n = argc > 1 ? atoi(argv[1]) : 100000;
+  if (n <= 0) {
+    fprintf(stderr, "Usage: %s [n]\n", argv[0]);
+    exit(0);
+  }
+  initjobs(&jobs);
+
+  t = now();
+  for (i = 0; i < n; i++) {
+    job = addjob(&jobs, pidof(i), BG, "./myspin 1 &\n");
+    addproc(&jobs, job, pidof(i));
+  }
+  report("add", n, now() - t);
+
+  t = now();
+  for (i = 0; i < n; i++)
+    if (getjobpid(&jobs, pidof(i)) == NULL)
+      misses++;
+  report("bypid", n, now() - t);
+
+  t = now();
+  for (i = 1; i <= n; i++)
+    if ((job = getjobjid(&jobs, i)) == NULL || pid2jid(&jobs, job->pid) != i)
+      misses++;
+  report("byjid", n, now() - t);
+
+  t = now();
+  for (i = 0; i < n; i += 2)
+    deletejob(&jobs, pidof(i));
+  for (i = n - 1; i > 0; i--)
+    if (i % 2 == 1)
+      deletejob(&jobs, pidof(i));
+  report("reap", n, now() - t);
+
+  if (misses != 0 || jobs.njobs != 0 || maxjid(&jobs) != 0) {
+    printf("bench_jobs: %d lookups failed, %d jobs left\n", misses, jobs.njobs);
+    exit(1);
+  }
+  freejobs(&jobs);
+  exit(0);
+}
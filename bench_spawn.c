@@ -0,0 +1,96 @@
+/*
+ * bench_spawn.c - Compare fork+exec against posix_spawn
+ *
+ * usage: bench_spawn [iterations] [rss MiB...]
+ * For each resident set size (default 0 16 128 512 MiB) the process
+ * grows to that size, then launches /bin/true `iterations` times
+ * (default 200) through each path and reports the mean turnaround.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static char *prog[] = { "/bin/true", NULL };
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_fork(void)
+{
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    execve(prog[0], prog, environ);
+    _exit(127);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+static void run_spawn(void)
+{
+  pid_t pid;
+  int r = posix_spawn(&pid, prog[0], NULL, NULL, prog, environ);
+  if (r != 0) {
+    fprintf(stderr, "posix_spawn: %s\n", strerror(r));
+    exit(1);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+static double timeit(void (*launch)(void), int n)
+{
+  double t = now();
+  int i;
+
+  for (i = 0; i < n; i++)
+    launch();
+  return (now() - t) * 1e6 / n;
+}
+
+int main(int argc, char **argv)
+{
+  static const long defsizes[] = { 0, 16, 128, 512 };
+  char *heap = NULL;
+  long have = 0, mib;
+  int i, n, nsizes;
+
+  n = argc > 1 ? atoi(argv[1]) : 200;
+  if (n <= 0) {
+    fprintf(stderr, "Usage: %s [iterations] [rss MiB...]\n", argv[0]);
+    exit(0);
+  }
+  nsizes = argc > 2 ? argc - 2 : (int)(sizeof(defsizes) / sizeof(defsizes[0]));
+
+  printf("%8s %12s %12s\n", "rss MiB", "fork us", "spawn us");
+  for (i = 0; i < nsizes; i++) {
+    mib = argc > 2 ? atol(argv[i + 2]) : defsizes[i];
+    if (mib > have) {
+      /* touch every page so it is really resident */
+      heap = realloc(heap, mib << 20);
+      if (heap == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+      memset(heap, 1, mib << 20);
+      have = mib;
+    }
+    printf("%8ld %12.1f", mib, timeit(run_fork, n));
+    printf(" %12.1f\n", timeit(run_spawn, n));
+  }
+  free(heap);
+  exit(0);
+}
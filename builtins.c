@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "builtins.h"
+#include "xargs.h"
+
+static int do_true(char **argv);
+static int do_false(char **argv);
+static int do_echo(char **argv);
+static int do_printf(char **argv);
+static int do_test(char **argv);
+
+static struct {
+  const char *name;
+  builtin_t *fn;
+} builtins[] = {
+  { "echo",   do_echo },
+  { "printf", do_printf },
+  { "test",   do_test },
+  { "[",      do_test },
+  { "true",   do_true },
+  { "false",  do_false },
+  { "xargs",  xargs_main },
+  { "parallel", xargs_main },
+};
+
+/* builtin_find - the builtin utility called name, or NULL */
+builtin_t *builtin_find(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+    if (strcmp(builtins[i].name, name) == 0)
+      return builtins[i].fn;
+  return NULL;
+}
+
+static int do_true(char **argv)
+{
+  (void)argv;
+  return 0;
+}
+
+static int do_false(char **argv)
+{
+  (void)argv;
+  return 1;
+}
+
+/*
+ * putesc - print the escape sequence that follows a backslash at p
+ *    and return what comes after it. With zero set (echo -e and %b)
+ *    octal escapes are written \0NNN, otherwise \NNN as in a printf
+ *    format. *stop is set by \c, which ends all output.
+ */
+static const char *putesc(const char *p, int zero, int *stop)
+{
+  int c, n;
+
+  switch (*p) {
+    case 'a':  c = '\a'; break;
+    case 'b':  c = '\b'; break;
+    case 'e':  c = 033;  break;
+    case 'f':  c = '\f'; break;
+    case 'n':  c = '\n'; break;
+    case 'r':  c = '\r'; break;
+    case 't':  c = '\t'; break;
+    case 'v':  c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'c':
+      *stop = 1;
+      return p + 1;
+    case 'x':
+      for (c = 0, n = 0, p++; n < 2 && isxdigit((unsigned char)*p); n++, p++)
+        c = c * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (*p | 0x20) - 'a' + 10);
+      if (n == 0) {
+        fputs("\\x", stdout);
+        return p;
+      }
+      putchar(c);
+      return p;
+    default:
+      if (*p >= '0' && *p <= '7' && (!zero || *p == '0')) {
+        if (zero)
+          p++;
+        for (c = 0, n = 0; n < 3 && *p >= '0' && *p <= '7'; n++)
+          c = c * 8 + *p++ - '0';
+        putchar(c);
+        return p;
+      }
+      putchar('\\');
+      if (*p == '\0')
+        return p;
+      c = *p;
+  }
+  putchar(c);
+  return p + 1;
+}
+
+/* putescs - print s, expanding backslash escapes; 1 if \c was seen */
+static int putescs(const char *s, int zero)
+{
+  int stop = 0;
+
+  while (*s && !stop) {
+    if (*s == '\\')
+      s = putesc(s + 1, zero, &stop);
+    else
+      putchar(*s++);
+  }
+  return stop;
+}
+
+/*
+ * echo - print the arguments. -n drops the newline, -e expands
+ *    backslash escapes and -E (the default) doesn't.
+ */
+static int do_echo(char **argv)
+{
+  int i, j, newline = 1, esc = 0;
+  char *a;
+
+  for (i = 1; (a = argv[i]) != NULL && a[0] == '-' && a[1] != '\0'; i++) {
+    for (j = 1; a[j] == 'n' || a[j] == 'e' || a[j] == 'E'; j++)
+      ;
+    if (a[j] != '\0')
+      break;
+    for (j = 1; a[j] != '\0'; j++) {
+      if (a[j] == 'n')
+        newline = 0;
+      else
+        esc = a[j] == 'e';
+    }
+  }
+
+  for (j = i; argv[j] != NULL; j++) {
+    if (j > i)
+      putchar(' ');
+    if (!esc)
+      fputs(argv[j], stdout);
+    else if (putescs(argv[j], 1))
+      return 0;
+  }
+  if (newline)
+    putchar('\n');
+  return 0;
+}
+
+/*
+ * number - the value of a printf argument: an integer in C notation,
+ *    or 'c for the code of character c. A bad one is reported and
+ *    counts as what could be read of it.
+ */
+static long long number(const char *arg, int *status)
+{
+  char *end;
+  long long n;
+
+  if (arg == NULL)
+    return 0;
+  if (arg[0] == '\'' || arg[0] == '"')
+    return (unsigned char)arg[1];
+  n = strtoll(arg, &end, 0);
+  if (end == arg || *end != '\0') {
+    printf("printf: %s: invalid number\n", arg);
+    *status = 1;
+  }
+  return n;
+}
+
+/*
+ * printf - print the arguments under control of a format. Supports
+ *    %s %b %c %d %i %u %o %x %X with flags, width and precision, and
+ *    reuses the format while arguments are left, like printf(1).
+ */
+static int do_printf(char **argv)
+{
+  char spec[32], **args, **first;
+  const char *p, *arg;
+  int n, status = 0, stop = 0;
+
+  if (argv[1] == NULL) {
+    printf("printf: usage: printf format [arguments]\n");
+    return 2;
+  }
+
+  args = argv + 2;
+  do {
+    first = args;
+    for (p = argv[1]; *p != '\0' && !stop; ) {
+      if (*p == '\\') {
+        p = putesc(p + 1, 0, &stop);
+        continue;
+      }
+      if (*p != '%') {
+        putchar(*p++);
+        continue;
+      }
+      if (p[1] == '%') {
+        putchar('%');
+        p += 2;
+        continue;
+      }
+
+      /* copy %[flags][width][.precision] and leave room for ll + conv */
+      n = 0;
+      spec[n++] = *p++;
+      while (*p != '\0' && strchr("-+ #0", *p) != NULL && n < 8)
+        spec[n++] = *p++;
+      while (isdigit((unsigned char)*p) && n < 16)
+        spec[n++] = *p++;
+      if (*p == '.')
+        for (spec[n++] = *p++; isdigit((unsigned char)*p) && n < 26; )
+          spec[n++] = *p++;
+      while (isdigit((unsigned char)*p) || *p == '.')
+        p++;
+
+      arg = *args != NULL ? *args++ : NULL;
+      switch (*p) {
+        case 's':
+          strcpy(spec + n, "s");
+          printf(spec, arg ? arg : "");
+          break;
+        case 'b':
+          if (arg != NULL && putescs(arg, 1))
+            stop = 1;
+          break;
+        case 'c':
+          strcpy(spec + n, "c");
+          if (arg != NULL && arg[0] != '\0')
+            printf(spec, arg[0]);
+          break;
+        case 'd':
+        case 'i':
+          strcpy(spec + n, "lld");
+          printf(spec, number(arg, &status));
+          break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+          spec[n++] = 'l';
+          spec[n++] = 'l';
+          spec[n++] = *p;
+          spec[n] = '\0';
+          printf(spec, (unsigned long long)number(arg, &status));
+          break;
+        case '\0':
+          printf("printf: %s: missing format character\n", spec);
+          return 1;
+        default:
+          printf("printf: %%%c: invalid directive\n", *p);
+          return 1;
+      }
+      p++;
+    }
+  } while (!stop && args != first && *args != NULL);
+  return status;
+}
+
+/*
+ * test - evaluate a conditional expression: exit status 0 if true,
+ *    1 if false and 2 on a syntax error. The grammar is the usual
+ *
+ *    expr    := and { -o and }
+ *    and     := not { -a not }
+ *    not     := ! not | primary
+ *    primary := ( expr ) | unary-op word | word binary-op word | word
+ *
+ *    except that three words with a binary operator in the middle are
+ *    always a comparison, so test ! = x and test ( = ( work.
+ */
+static char **tv;           /* operands left to evaluate */
+static int tc;              /* how many */
+static const char *tname;   /* "test" or "[" */
+static int terror;
+
+static int texpr(void);
+
+static int isunary(const char *s)
+{
+  return s[0] == '-' && s[1] != '\0' && s[2] == '\0' &&
+         strchr("bcdefghLnprsStuwxz", s[1]) != NULL;
+}
+
+static int isbinary(const char *s)
+{
+  static const char *ops[] = {
+    "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+    "-nt", "-ot", "-ef", NULL
+  };
+  int i;
+
+  for (i = 0; ops[i] != NULL; i++)
+    if (strcmp(s, ops[i]) == 0)
+      return 1;
+  return 0;
+}
+
+static const char *tnext(void)
+{
+  if (tc == 0) {
+    if (!terror)
+      printf("%s: argument expected\n", tname);
+    terror = 1;
+    return "";
+  }
+  tc--;
+  return *tv++;
+}
+
+static long long tint(const char *s)
+{
+  char *end;
+  long long n = strtoll(s, &end, 10);
+
+  while (*end == ' ' || *end == '\t')
+    end++;
+  if (end == s || *end != '\0') {
+    if (!terror)
+      printf("%s: %s: integer expression expected\n", tname, s);
+    terror = 1;
+  }
+  return n;
+}
+
+static int tunary(char op, const char *s)
+{
+  struct stat st;
+
+  switch (op) {
+    case 'n': return *s != '\0';
+    case 'z': return *s == '\0';
+    case 't': return isatty(tint(s));
+    case 'r': return access(s, R_OK) == 0;
+    case 'w': return access(s, W_OK) == 0;
+    case 'x': return access(s, X_OK) == 0;
+    case 'h':
+    case 'L': return lstat(s, &st) == 0 && S_ISLNK(st.st_mode);
+  }
+  if (stat(s, &st) < 0)
+    return 0;
+  switch (op) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+  }
+  return 1; /* -e */
+}
+
+static int tbinary(const char *a, const char *op, const char *b)
+{
+  struct stat sa, sb;
+  int ha, hb;
+
+  if (op[0] != '-') {
+    if (op[0] == '!')
+      return strcmp(a, b) != 0;
+    if (op[0] == '<')
+      return strcmp(a, b) < 0;
+    if (op[0] == '>')
+      return strcmp(a, b) > 0;
+    return strcmp(a, b) == 0;
+  }
+  if ((op[1] == 'n' && op[2] == 't') || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')) {
+    ha = stat(a, &sa) == 0;
+    hb = stat(b, &sb) == 0;
+    if (op[1] == 'e')
+      return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    if (op[1] == 'o') {
+      struct stat t = sa;
+      int h = ha;
+      sa = sb, ha = hb, sb = t, hb = h;
+    }
+    if (!ha || !hb)
+      return ha;
+    return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+           (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec &&
+            sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec);
+  }
+  if (strcmp(op, "-eq") == 0) return tint(a) == tint(b);
+  if (strcmp(op, "-ne") == 0) return tint(a) != tint(b);
+  if (strcmp(op, "-lt") == 0) return tint(a) < tint(b);
+  if (strcmp(op, "-le") == 0) return tint(a) <= tint(b);
+  if (strcmp(op, "-gt") == 0) return tint(a) > tint(b);
+  return tint(a) >= tint(b); /* -ge */
+}
+
+static int tprimary(void)
+{
+  const char *a, *op;
+  int r;
+
+  if (tc >= 3 && isbinary(tv[1])) {
+    a = tnext();
+    op = tnext();
+    return tbinary(a, op, tnext());
+  }
+  a = tnext();
+  if (strcmp(a, "(") == 0 && tc > 0) {
+    r = texpr();
+    if (strcmp(tnext(), ")") != 0 && !terror) {
+      printf("%s: ')' expected\n", tname);
+      terror = 1;
+    }
+    return r;
+  }
+  if (isunary(a) && tc > 0)
+    return tunary(a[1], tnext());
+  return *a != '\0';
+}
+
+static int tnot(void)
+{
+  if (tc >= 2 && strcmp(tv[0], "!") == 0 && !(tc >= 3 && isbinary(tv[1]))) {
+    tnext();
+    return !tnot();
+  }
+  return tprimary();
+}
+
+static int tand(void)
+{
+  int r = tnot();
+
+  while (tc > 0 && strcmp(tv[0], "-a") == 0) {
+    tnext();
+    r = tnot() && r;
+  }
+  return r;
+}
+
+static int texpr(void)
+{
+  int r = tand();
+
+  while (tc > 0 && strcmp(tv[0], "-o") == 0) {
+    tnext();
+    r = tand() || r;
+  }
+  return r;
+}
+
+static int do_test(char **argv)
+{
+  int r;
+
+  tname = argv[0];
+  tv = argv + 1;
+  for (tc = 0; tv[tc] != NULL; tc++)
+    ;
+  if (strcmp(tname, "[") == 0) {
+    if (tc == 0 || strcmp(tv[tc - 1], "]") != 0) {
+      printf("[: missing ]\n");
+      return 2;
+    }
+    tc--;
+  }
+  if (tc == 0)
+    return 1;
+
+  terror = 0;
+  r = texpr();
+  if (tc > 0 && !terror) {
+    printf("%s: %s: unexpected argument\n", tname, tv[0]);
+    terror = 1;
+  }
+  return terror ? 2 : !r;
+}
@@ -0,0 +1,13 @@
+#ifndef FILE_BUILTINS
+#define FILE_BUILTINS
+
+/*
+ * Utilities the shell runs itself instead of exec'ing a program:
+ * echo, printf, test ([), true and false. Each one writes to stdout
+ * and returns its exit status; the caller sets up the fds and flushes.
+ * xargs and parallel are here too for pipeline stages, see xargs.h.
+ */
+typedef int builtin_t(char **argv);
+
+builtin_t *builtin_find(const char *name);
+#endif
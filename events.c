@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include "events.h"
+
+static int epfd = -1;       /* the epoll set */
+static int sigfd = -1;      /* signalfd for the blocked signals */
+static int infd = -1;       /* fd command lines come from */
+static int inadded;         /* infd is in the epoll set */
+static int inready;         /* infd can't be polled, so it is always ready */
+
+/*
+ * events_init - block sigs and start taking them from a signalfd.
+ *    Returns -1 (with errno set) if the fds can't be made. A forked
+ *    subshell calls it again to drop the shell's fds for its own.
+ */
+int events_init(const sigset_t *sigs)
+{
+  struct epoll_event ev;
+
+  if (epfd >= 0) {
+    close(epfd);
+    close(sigfd);
+  }
+  if (sigprocmask(SIG_BLOCK, sigs, NULL) < 0)
+    return -1;
+  if ((sigfd = signalfd(-1, sigs, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+    return -1;
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return -1;
+  ev.events = EPOLLIN;
+  ev.data.fd = sigfd;
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+}
+
+/*
+ * events_input - wait for fd as well when asked to. Regular files
+ *    (and /dev/null) can't be polled; they never block, so they just
+ *    count as readable.
+ */
+void events_input(int fd)
+{
+  infd = fd;
+  inadded = 0;
+  inready = 0;
+}
+
+/* events_add - also wake up when fd (a child's pidfd) is readable */
+int events_add(int fd)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* events_del - stop watching fd; call before closing it */
+void events_del(int fd)
+{
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/*
+ * events_wait - sleep up to timeout ms (-1 for ever) until a signal
+ *    is pending or, if input is set, the input fd is readable. The
+ *    input fd is armed one shot at a time, so a foreground wait isn't
+ *    woken over and over by lines that are already waiting.
+ *    Returns a mask of EV_INPUT, EV_SIGNAL and EV_CHILD.
+ */
+int events_wait(int input, int timeout)
+{
+  struct epoll_event ev, evs[16];
+  int i, n, r = 0;
+
+  if (input && inready) {
+    r = EV_INPUT;
+    timeout = 0;
+  } else if (input && infd >= 0) {
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = infd;
+    if (epoll_ctl(epfd, inadded ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, infd, &ev) == 0) {
+      inadded = 1;
+    } else if (errno == EPERM) {
+      inready = 1;
+      r = EV_INPUT;
+      timeout = 0;
+    }
+  }
+
+  n = epoll_wait(epfd, evs, 16, timeout);
+  for (i = 0; i < n; i++) {
+    if (evs[i].data.fd == sigfd)
+      r |= EV_SIGNAL;
+    else if (evs[i].data.fd == infd)
+      r |= EV_INPUT;
+    else
+      r |= EV_CHILD;
+  }
+  return r;
+}
+
+/*
+ * events_read - sleep until fd, which the shell is about to read
+ *    itself, is readable or a signal is pending. Returns a mask of
+ *    EV_INPUT and EV_SIGNAL; on an error it says EV_INPUT, so the read
+ *    reports it.
+ */
+int events_read(int fd)
+{
+  struct pollfd p[2];
+  int r = 0;
+
+  p[0].fd = fd;
+  p[1].fd = sigfd;
+  p[0].events = p[1].events = POLLIN;
+  if (poll(p, 2, -1) < 0)
+    return EV_INPUT;
+  if (p[0].revents != 0)
+    r |= EV_INPUT;
+  if (p[1].revents != 0)
+    r |= EV_SIGNAL;
+  return r;
+}
+
+/* events_signal - take the next pending signal; 0 if there is none */
+int events_signal(struct signalfd_siginfo *si)
+{
+  return read(sigfd, si, sizeof(*si)) == sizeof(*si);
+}
+
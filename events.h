@@ -0,0 +1,26 @@
+#ifndef FILE_EVENTS
+#define FILE_EVENTS
+
+#include <signal.h>
+#include <sys/signalfd.h>
+
+/*
+ * The shell's one place to sleep: an epoll set holding a signalfd for
+ * the job control signals, which stay blocked for good, and the fd
+ * that command lines are read from, plus a pidfd for every child the
+ * shell hasn't reaped. Signals are taken one at a time
+ * with events_signal and handled like any other input, so job state
+ * never changes under the shell's feet.
+ */
+#define EV_INPUT    1    /* the input fd is readable */
+#define EV_SIGNAL   2    /* there are signals to take */
+#define EV_CHILD    4    /* a child with a watched pidfd exited */
+
+int events_init(const sigset_t *sigs);
+void events_input(int fd);
+int events_add(int fd);
+void events_del(int fd);
+int events_wait(int input, int timeout);
+int events_read(int fd);
+int events_signal(struct signalfd_siginfo *si);
+#endif
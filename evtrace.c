@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "evtrace.h"
+
+#define RINGSIZE    4096     /* events kept, a power of two */
+
+struct event {
+  long long ts;             /* CLOCK_MONOTONIC, ns */
+  pid_t pid;
+  int jid;
+  int type;
+  int arg;
+};
+
+static struct event ring[RINGSIZE];
+static unsigned long head;  /* events ever added; the next slot is head % RINGSIZE */
+
+static const char *names[NTRACE] = {
+  "spawn", "fork", "exec", "stop", "exit", "signal", "state"
+};
+
+/* evtrace_now - the clock events are stamped with, in ns */
+long long evtrace_now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* evtrace_at - add an event that happened at ts */
+void evtrace_at(long long ts, int type, pid_t pid, int jid, int arg)
+{
+  unsigned long i = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  struct event *e = &ring[i & (RINGSIZE - 1)];
+
+  e->ts = ts;
+  e->pid = pid;
+  e->jid = jid;
+  e->type = type;
+  e->arg = arg;
+}
+
+/* evtrace_add - add an event that happens now */
+void evtrace_add(int type, pid_t pid, int jid, int arg)
+{
+  evtrace_at(evtrace_now(), type, pid, jid, arg);
+}
+
+/* evtrace_clear - forget every event */
+void evtrace_clear(void)
+{
+  head = 0;
+}
+
+/* evtrace_count - how many events the ring holds */
+long evtrace_count(void)
+{
+  return head < RINGSIZE ? head : RINGSIZE;
+}
+
+/*
+ * evtrace_dump - write the ring to file as Chrome trace-event JSON.
+ *    Jobs are trace processes and their processes are threads. A
+ *    process is a slice from spawn (or fork) to exit, and the other
+ *    events are instants on it; job-wide ones sit on the leader's
+ *    track. Returns -1 if file can't be written.
+ */
+int evtrace_dump(const char *file)
+{
+  static const char *states[] = { "undef", "fg", "bg", "stopped" };
+  unsigned long i, end = head;
+  struct event *e;
+  FILE *fp;
+  int n = 0;
+
+  if ((fp = fopen(file, "w")) == NULL)
+    return -1;
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (i = end > RINGSIZE ? end - RINGSIZE : 0; i < end; i++) {
+    e = &ring[i & (RINGSIZE - 1)];
+    fprintf(fp, "%s{\"name\":\"%s\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d,",
+        n++ ? ",\n" : "", names[e->type], e->ts / 1000, e->ts % 1000,
+        e->jid, e->pid);
+    switch (e->type) {
+      case TR_SPAWN:
+      case TR_FORK:
+        fprintf(fp, "\"ph\":\"B\"}");
+        break;
+      case TR_EXIT:
+        if (WIFSIGNALED(e->arg))
+          fprintf(fp, "\"ph\":\"E\",\"args\":{\"signal\":%d}}", WTERMSIG(e->arg));
+        else
+          fprintf(fp, "\"ph\":\"E\",\"args\":{\"status\":%d}}", WEXITSTATUS(e->arg));
+        break;
+      case TR_STOP:
+      case TR_SIGNAL:
+        fprintf(fp, "\"ph\":\"i\",\"args\":{\"signal\":%d}}", e->arg);
+        break;
+      case TR_STATE:
+        fprintf(fp, "\"ph\":\"i\",\"args\":{\"state\":\"%s\"}}",
+            states[e->arg & 3]);
+        break;
+      default:
+        fprintf(fp, "\"ph\":\"i\"}");
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  return fclose(fp);
+}
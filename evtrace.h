@@ -0,0 +1,31 @@
+#ifndef FILE_EVTRACE
+#define FILE_EVTRACE
+
+#include <sys/types.h>
+
+/*
+ * A fixed-size ring of binary job control events, always on. Adding
+ * one is a clock read, an atomic increment and a few stores, with no
+ * lock and no allocation, so it is safe even from a signal handler.
+ * When the ring is full the oldest events are overwritten.
+ * evtrace_dump writes what is there as Chrome trace-event JSON, one
+ * track per process, grouped by job.
+ */
+enum {
+  TR_SPAWN,                 /* posix_spawn called; arg unused */
+  TR_FORK,                  /* fork called */
+  TR_EXEC,                  /* posix_spawn returned, the child exec'd */
+  TR_STOP,                  /* a process stopped; arg is the signal */
+  TR_EXIT,                  /* a process was reaped; arg is its wait status */
+  TR_SIGNAL,                /* a signal sent to a job; pid is the pgid */
+  TR_STATE,                 /* a job changed state; arg is FG, BG or ST */
+  NTRACE
+};
+
+long long evtrace_now(void);
+void evtrace_add(int type, pid_t pid, int jid, int arg);
+void evtrace_at(long long ts, int type, pid_t pid, int jid, int arg);
+void evtrace_clear(void);
+long evtrace_count(void);
+int evtrace_dump(const char *file);
+#endif
@@ -0,0 +1,545 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "expand.h"
+#include "parser.h"
+#include "vars.h"
+
+#define READMIN     4096      /* first read of $(cmd) output */
+#define READMAX     (1 << 20) /* reads double up to this */
+
+/*
+ * The words of an expanded argv. Each one is grown in the arena, so
+ * they are collected in vec, outside it, and copied in at the end.
+ */
+struct words {
+  struct arena *a;
+  int n;
+  int have;                 /* the word being grown is a word already */
+  int split;                /* split expansions at blanks */
+};
+
+static const char special[] = { '$', TOK_PROCSUB, 0 }; /* what starts an expansion */
+static char **vec;          /* kept from line to line */
+static int veccap;
+
+struct arith {
+  const char *s, *end;
+  const struct params *p;
+  const char *err;          /* why it failed, or NULL */
+};
+
+static const char *param(const char **sp, char *buf, const struct params *p, int *bad);
+static long long arith(const char *expr, int len, const struct params *p, const char **err);
+
+static void push(struct words *w, char *word)
+{
+  if (w->n == veccap) {
+    veccap = veccap ? veccap * 2 : 64;
+    vec = realloc(vec, veccap * sizeof(char *));
+  }
+  vec[w->n++] = word;
+}
+
+/* endword - Close the word being grown and add it to the vector */
+static void endword(struct words *w)
+{
+  arena_grow(w->a, 0);
+  push(w, arena_finish(w->a));
+  w->have = 0;
+}
+
+/* append - Add the value of an expansion, split at blanks unless quoted */
+static void append(struct words *w, const char *val, int quoted)
+{
+  if (quoted || !w->split) {
+    while (*val)
+      arena_grow(w->a, *val++);
+    w->have = 1;
+    return;
+  }
+  for (; *val; val++) {
+    if (!is_blank(*val)) {
+      arena_grow(w->a, *val);
+      w->have = 1;
+    } else if (w->have) {
+      endword(w);
+    }
+  }
+}
+
+/*
+ * closing - The ) that closes the ( at s, skipping quotes as get_tokens
+ *    did, or NULL if there is none: here-document text was not checked
+ */
+static const char *closing(const char *s)
+{
+  int depth = 0;
+  char q;
+
+  for (;; s++) {
+    if (*s == '\'' || *s == '"')
+      for (q = *s++; *s != q; s++)
+        if (*s == 0)
+          return NULL;
+    if (*s == 0)
+      return NULL;
+    depth += (*s == '(') - (*s == ')');
+    if (depth == 0)
+      return s;
+  }
+}
+
+/*
+ * capture - Grow the output of cmd (len bytes) onto w, less trailing
+ *    newlines. It is read straight into the arena, in reads that
+ *    double (and a pipe made bigger) while they come back full. Then,
+ *    unless quoted, it is cut into words in place: blanks are squeezed
+ *    out, each word before the last is closed with a NUL, and the last
+ *    one goes on growing.
+ */
+static int capture(struct words *w, const char *cmd, int len, int quoted,
+                   const struct params *p)
+{
+  size_t start = w->a->objlen, room = READMIN, r, o, end, word;
+  ssize_t n;
+  int fd[2];
+  pid_t pid;
+  char *obj, c;
+
+  if (pipe2(fd, O_CLOEXEC) < 0) {
+    printf("pipe error: %s\n", strerror(errno));
+    return -1;
+  }
+  pid = p->start(cmd, len, fd[1]);
+  close(fd[1]);
+  if (pid < 0) {
+    close(fd[0]);
+    return -1;
+  }
+  while ((n = read(fd[0], arena_room(w->a, room), room)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    arena_grew(w->a, n);
+    if ((size_t)n == room && room < READMAX) {
+      room *= 2;
+      if (room == READMAX)
+        fcntl(fd[0], F_SETPIPE_SZ, READMAX);
+    }
+  }
+  close(fd[0]);
+  p->finish(pid);
+
+  obj = arena_room(w->a, 0) - w->a->objlen;
+  end = w->a->objlen;
+  while (end > start && obj[end - 1] == '\n')
+    end--;
+  if (quoted || !w->split) {
+    w->a->objlen = end;
+    w->have = 1;
+    return 0;
+  }
+
+  /* the word being grown started at 0; words start after each NUL */
+  for (word = 0, r = o = start; r < end; r++) {
+    c = obj[r];
+    if (!is_blank(c)) {
+      obj[o++] = c;
+      w->have = 1;
+    } else if (w->have) {
+      obj[o++] = 0;
+      push(w, obj + word);
+      word = o;
+      w->have = 0;
+    }
+  }
+  w->a->objlen = o;
+  arena_split(w->a, word);
+  return 0;
+}
+
+/*
+ * subst - Grow the expansion of word onto w. Returns -1 (after
+ *    printing a message) if it can't be expanded.
+ */
+static int subst(struct words *w, const char *word, const struct params *p)
+{
+  const char *s = word, *val, *end, *dollar;
+  char buf[32];
+  int quoted, bad = 0, i;
+  long long n;
+
+  while (*s) {
+    if (*s == TOK_LITERAL) {
+      arena_grow(w->a, '$');
+      w->have = 1;
+      s += 2;
+      continue;
+    }
+    if (*s == TOK_PROCSUB) {
+      /* <(cmd) or >(cmd): the path of the pipe to it, never split */
+      if ((end = closing(s + 2)) == NULL) {
+        printf("unterminated %c(\n", s[1]);
+        return -1;
+      }
+      if ((val = p->procsub(s[1], s + 3, end - s - 3)) == NULL)
+        return -1;
+      append(w, val, 1);
+      w->have = 1;
+      s = end + 1;
+      continue;
+    }
+    quoted = *s == TOK_QUOTED;
+    s += quoted;
+    if (*s != '$') {
+      arena_grow(w->a, *s++);
+      w->have = 1;
+      continue;
+    }
+    dollar = s;
+
+    s++;
+    if (s[0] == '(' && s[1] == '(') {
+      /* $((expr)), which get_tokens kept whole: the second ( must
+         close right before the first */
+      end = closing(s + 1);
+      if (end != NULL && end[1] == ')') {
+        end++;
+        n = arith(s + 2, end - 1 - (s + 2), p, &val);
+        if (val != NULL) {
+          printf("$((%.*s)): %s\n", (int)(end - 1 - (s + 2)), s + 2, val);
+          return -1;
+        }
+        snprintf(buf, sizeof(buf), "%lld", n);
+        append(w, buf, quoted);
+        s = end + 1;
+        continue;
+      }
+    }
+    if (*s == '(') {
+      if ((end = closing(s)) == NULL) {
+        printf("unterminated $(\n");
+        return -1;
+      }
+      if (capture(w, s + 1, end - s - 1, quoted, p) < 0)
+        return -1;
+      if (quoted)
+        w->have = 1;
+      s = end + 1;
+      continue;
+    }
+    if (*s == '@' && quoted && w->split) {
+      /* "$@": a word per parameter, and none if there are none */
+      for (i = 1; i < p->posc; i++) {
+        if (i > 1)
+          endword(w);
+        append(w, p->posv[i], 1);
+      }
+      s++;
+      continue;
+    }
+    if (*s == '@' || *s == '*') {
+      for (i = 1; i < p->posc; i++) {
+        if (i > 1)
+          append(w, " ", quoted);
+        append(w, p->posv[i], quoted);
+      }
+      if (quoted)
+        w->have = 1;
+      s++;
+      continue;
+    }
+    if ((val = param(&s, buf, p, &bad)) != NULL) {
+      append(w, val, quoted);
+      if (quoted)
+        w->have = 1;
+    } else if (bad) {
+      /* up to the end of the line, for here-document text */
+      printf("%.*s: bad substitution\n", (int)strcspn(dollar, "\n"), dollar);
+      return -1;
+    } else {
+      arena_grow(w->a, '$');
+      w->have = 1;
+    }
+  }
+  return 0;
+}
+
+/* isassign - true for a NAME=value word */
+static int isassign(const char *word)
+{
+  const char *eq = strchr(word, '=');
+
+  return eq != NULL && var_valid(word, eq - word);
+}
+
+/*
+ * expand_argv - argv with the $ in its words expanded, or NULL (after
+ *    printing a message) if one can't be. Operators are left alone,
+ *    and so is argv when there is nothing to expand.
+ */
+char **expand_argv(struct arena *a, char **argv, const struct params *p)
+{
+  struct words w = { a, 0, 0, 0 };
+  int i;
+
+  for (i = 0; argv[i] != NULL && (is_op(argv[i]) || strpbrk(argv[i], special) == NULL); i++)
+    ;
+  if (argv[i] == NULL)
+    return argv;
+
+  for (i = 0; argv[i] != NULL; i++) {
+    if (is_op(argv[i]) || strpbrk(argv[i], special) == NULL) {
+      push(&w, argv[i]);
+      continue;
+    }
+    /* nor is a file name or here text */
+    w.split = !isassign(argv[i]) &&
+              !(i > 0 && is_redirop(argv[i - 1]) && !is_ionum(argv[i - 1]));
+    if (subst(&w, argv[i], p) < 0) {
+      arena_finish(a);
+      return NULL;
+    }
+    if (w.have)
+      endword(&w);
+  }
+  push(&w, NULL);
+  argv = arena_alloc(a, w.n * sizeof(char *));
+  memcpy(argv, vec, w.n * sizeof(char *));
+  return argv;
+}
+
+/*
+ * expand_word - word with its $ expanded, as one word, or NULL (after
+ *    printing a message) if it can't be
+ */
+char *expand_word(struct arena *a, char *word, const struct params *p)
+{
+  struct words w = { a, 0, 0, 0 };
+
+  if (strpbrk(word, special) == NULL)
+    return word;
+  if (subst(&w, word, p) < 0) {
+    arena_finish(a);
+    return NULL;
+  }
+  arena_grow(a, 0);
+  return arena_finish(a);
+}
+
+/*
+ * param - The value of the parameter named at *sp, just past a $, and
+ *    move *sp past the name: a variable or a special parameter, maybe
+ *    in braces. Unset ones are "". NULL if there is no name there,
+ *    with *bad set if there are braces around something else.
+ */
+static const char *param(const char **sp, char *buf, const struct params *p, int *bad)
+{
+  const char *s = *sp, *name = s, *val;
+  int len = 0, brace = *s == '{';
+
+  if (brace) {
+    name = ++s;
+    while (s[len] != '}' && s[len] != 0)
+      len++;
+    if (s[len] == 0 || (!var_valid(name, len) && !(len == 1 && strchr("?$#", *name)) &&
+                        !(len > 0 && strspn(name, "0123456789") == (size_t)len))) {
+      *bad = 1;
+      return NULL;
+    }
+  } else if (*s == '_' || isalpha((unsigned char)*s)) {
+    while (s[len] == '_' || isalnum((unsigned char)s[len]))
+      len++;
+  } else if (*s != 0 && strchr("?$#0123456789", *s)) {
+    len = 1;
+  } else {
+    return NULL;
+  }
+  *sp = s + len + brace;
+
+  if (*name == '?' || *name == '$' || *name == '#') {
+    snprintf(buf, 32, "%lld", *name == '?' ? (long long)p->status :
+             *name == '$' ? (long long)p->pid : (long long)p->posc - 1);
+    return buf;
+  }
+  if (isdigit((unsigned char)*name)) {
+    len = atoi(name);
+    return len < p->posc ? p->posv[len] : "";
+  }
+  val = var_getn(name, len);
+  return val != NULL ? val : "";
+}
+
+/*
+ * Arithmetic, by precedence climbing over C's binary operators. All
+ * of them evaluate both sides, and overflow wraps.
+ */
+static const struct {
+  const char *op;
+  int prec;
+} binops[] = {
+  { "||", 1 }, { "&&", 2 }, { "==", 6 }, { "!=", 6 }, { "<=", 7 },
+  { ">=", 7 }, { "<<", 8 }, { ">>", 8 }, { "|", 3 }, { "^", 4 },
+  { "&", 5 }, { "<", 7 }, { ">", 7 }, { "+", 9 }, { "-", 9 },
+  { "*", 10 }, { "/", 10 }, { "%", 10 },
+};
+
+static void skipblanks(struct arith *ar)
+{
+  while (ar->s < ar->end && is_blank(*ar->s))
+    ar->s++;
+}
+
+/* binop - The operator at ar->s, as an index into binops, or -1 */
+static int binop(struct arith *ar)
+{
+  size_t i, n;
+
+  skipblanks(ar);
+  for (i = 0; i < sizeof(binops) / sizeof(binops[0]); i++) {
+    n = strlen(binops[i].op);
+    if (ar->end - ar->s >= (long)n && strncmp(ar->s, binops[i].op, n) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/* number - A variable's value as a number; unset or empty is 0 */
+static long long number(struct arith *ar, const char *val)
+{
+  char *end;
+  long long n;
+
+  if (val == NULL || *val == 0)
+    return 0;
+  n = strtoll(val, &end, 0);
+  if (*end != 0 && ar->err == NULL)
+    ar->err = "not a number";
+  return n;
+}
+
+static long long binary(struct arith *ar, int minprec);
+
+static long long unary(struct arith *ar)
+{
+  const char *name, *val;
+  char buf[32], *end;
+  long long n;
+  int len = 0, bad = 0;
+
+  skipblanks(ar);
+  if (ar->s == ar->end) {
+    ar->err = "missing operand";
+    return 0;
+  }
+  switch (*ar->s) {
+    case '-':
+      ar->s++;
+      return 0ULL - unary(ar);
+    case '+':
+      ar->s++;
+      return unary(ar);
+    case '!':
+      ar->s++;
+      return !unary(ar);
+    case '~':
+      ar->s++;
+      return ~unary(ar);
+    case '(':
+      ar->s++;
+      n = binary(ar, 1);
+      skipblanks(ar);
+      if (ar->s == ar->end || *ar->s != ')') {
+        if (ar->err == NULL)
+          ar->err = "missing )";
+        return 0;
+      }
+      ar->s++;
+      return n;
+    case '$':
+      ar->s++;
+      if ((val = param(&ar->s, buf, ar->p, &bad)) == NULL)
+        ar->err = "bad substitution";
+      return number(ar, val);
+  }
+  if (isdigit((unsigned char)*ar->s)) {
+    n = strtoll(ar->s, &end, 0);
+    ar->s = end;
+    return n;
+  }
+  name = ar->s;
+  while (name + len < ar->end && (name[len] == '_' || isalnum((unsigned char)name[len])))
+    len++;
+  if (!var_valid(name, len)) {
+    ar->err = "syntax error";
+    return 0;
+  }
+  ar->s += len;
+  return number(ar, var_getn(name, len));
+}
+
+static long long binary(struct arith *ar, int minprec)
+{
+  long long l = unary(ar), r;
+  int i;
+
+  while (ar->err == NULL && (i = binop(ar)) >= 0 && binops[i].prec >= minprec) {
+    ar->s += strlen(binops[i].op);
+    r = binary(ar, binops[i].prec + 1);
+    switch (binops[i].op[0] + (binops[i].op[1] << 8)) {
+      case '|' + ('|' << 8): l = l || r; break;
+      case '&' + ('&' << 8): l = l && r; break;
+      case '=' + ('=' << 8): l = l == r; break;
+      case '!' + ('=' << 8): l = l != r; break;
+      case '<' + ('=' << 8): l = l <= r; break;
+      case '>' + ('=' << 8): l = l >= r; break;
+      case '<' + ('<' << 8): l = (unsigned long long)l << (r & 63); break;
+      case '>' + ('>' << 8): l >>= r & 63; break;
+      case '|': l |= r; break;
+      case '^': l ^= r; break;
+      case '&': l &= r; break;
+      case '<': l = l < r; break;
+      case '>': l = l > r; break;
+      case '+': l = (unsigned long long)l + r; break;
+      case '-': l = (unsigned long long)l - r; break;
+      case '*': l = (unsigned long long)l * r; break;
+      case '/':
+      case '%':
+        if (r == 0) {
+          ar->err = "division by zero";
+          return 0;
+        }
+        if (r == -1)
+          l = binops[i].op[0] == '/' ? (long long)(0ULL - l) : 0;
+        else
+          l = binops[i].op[0] == '/' ? l / r : l % r;
+        break;
+    }
+  }
+  return l;
+}
+
+/*
+ * arith - Evaluate the len bytes of expr. *err is NULL, or says why
+ *    it could not be.
+ */
+static long long arith(const char *expr, int len, const struct params *p, const char **err)
+{
+  struct arith ar = { expr, expr + len, p, NULL };
+  long long n;
+
+  n = binary(&ar, 1);
+  skipblanks(&ar);
+  if (ar.err == NULL && ar.s != ar.end)
+    ar.err = "syntax error";
+  *err = ar.err;
+  return n;
+}
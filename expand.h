@@ -0,0 +1,44 @@
+#ifndef FILE_EXPAND
+#define FILE_EXPAND
+
+#include <sys/types.h>
+#include "arena.h"
+
+/*
+ * Expansion of the $ that get_tokens leaves in words, done when the
+ * command runs so it sees what the commands before it did:
+ *
+ *   $NAME ${NAME}     a shell variable, see vars.h ("" if unset)
+ *   $? $$ $# $0..$9   the status of the last command, the shell's
+ *   $@ $*             PID, and the positional parameters
+ *   $((expr))         C integer arithmetic on long long, where names
+ *                     are variables; it is done in the shell
+ *   $(cmd)            what cmd writes to stdout, less trailing newlines
+ *   <(cmd) >(cmd)     a /dev/fd path to read cmd's output from, or to
+ *                     write its input to, which is one word
+ *
+ * What an unquoted $ expands to is split into words at blanks; inside
+ * "..." it is not, but for "$@", which is a word per parameter, and
+ * inside '...' $ is just a $. A NAME=value word,
+ * the file of a redirection and here-document text are never split.
+ * The new words go in arena a.
+ *
+ * The output of $(cmd) is read straight into the word being built in
+ * the arena, which grows geometrically, and then split in place in one
+ * pass. The shell runs cmd, with start, and reaps it, with finish.
+ * procsub starts the cmd of <(cmd) (dir '<') or >(cmd) (dir '>') and
+ * returns the path, which need only last until it is copied.
+ */
+struct params {
+  int status;               /* $? */
+  pid_t pid;                /* $$ */
+  char **posv;              /* $0, $1, ... */
+  int posc;
+  pid_t (*start)(const char *cmd, int len, int out); /* -1 on failure */
+  void (*finish)(pid_t pid);
+  const char *(*procsub)(int dir, const char *cmd, int len); /* NULL on failure */
+};
+
+char **expand_argv(struct arena *a, char **argv, const struct params *p);
+char *expand_word(struct arena *a, char *word, const struct params *p);
+#endif
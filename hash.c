@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "hash.h"
+#include "stats.h"
+#include "vars.h"
+
+#define NBUCKETS    128  /* buckets in the command table */
+#define DEFPATH     "/bin:/usr/bin"
+#define DIRMASK     (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                     IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct hashent {
+  char *name;               /* command name as typed */
+  char *path;               /* where it was found */
+  int hits;                 /* times it was looked up */
+  struct hashent *next;
+};
+
+struct pathdir {
+  char *dir;                /* one PATH component ("" means ".") */
+  int wd;                   /* inotify watch, -1 if none */
+  struct timespec mtime;    /* checked by hand when there is no watch */
+};
+
+static struct hashent *table[NBUCKETS];
+static char *curpath;       /* the PATH the table was filled from */
+static struct pathdir *dirs;
+static int ndirs;
+static int notify_fd = -1;  /* inotify instance watching the dirs */
+
+static unsigned strhash(const char *s)
+{
+  unsigned h = 5381;
+  while (*s)
+    h = h * 33 + (unsigned char)*s++;
+  return h % NBUCKETS;
+}
+
+static struct timespec dirmtime(const char *dir)
+{
+  struct stat st;
+  struct timespec none = { 0, 0 };
+
+  if (stat(*dir ? dir : ".", &st) < 0)
+    return none;
+  return st.st_mtim;
+}
+
+/*
+ * setpath - split a new PATH into directories and watch each one, so
+ *    hash_check hears about binaries being added or removed
+ */
+static void setpath(const char *path)
+{
+  const char *p, *colon;
+  int i;
+
+  for (i = 0; i < ndirs; i++)
+    free(dirs[i].dir);
+  free(dirs);
+  free(curpath);
+  if (notify_fd >= 0)
+    close(notify_fd);
+
+  curpath = strdup(path);
+  ndirs = 1;
+  for (p = path; *p; p++)
+    ndirs += *p == ':';
+  dirs = malloc(ndirs * sizeof(*dirs));
+  notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  for (i = 0, p = path; i < ndirs; i++, p = colon + 1) {
+    colon = strchr(p, ':');
+    if (colon == NULL)
+      colon = p + strlen(p);
+    dirs[i].dir = strndup(p, colon - p);
+    dirs[i].wd = -1;
+    if (notify_fd >= 0)
+      dirs[i].wd = inotify_add_watch(notify_fd, *dirs[i].dir ? dirs[i].dir : ".",
+          DIRMASK);
+    dirs[i].mtime = dirmtime(dirs[i].dir);
+  }
+}
+
+/*
+ * hash_check - Forget every remembered location if PATH changed or a
+ *    PATH directory changed since the table was filled. PATH is the
+ *    shell variable, exported or not, as set for the command at hand.
+ */
+void hash_check(void)
+{
+  const char *path = var_get("PATH");
+  char buf[4096];
+  struct timespec t;
+  int i, stale = 0;
+
+  if (path == NULL)
+    path = DEFPATH;
+  if (curpath == NULL || strcmp(path, curpath) != 0) {
+    hash_clear();
+    setpath(path);
+    return;
+  }
+
+  if (notify_fd >= 0)
+    while (read(notify_fd, buf, sizeof(buf)) > 0)
+      stale = 1;
+  for (i = 0; i < ndirs; i++) {
+    if (dirs[i].wd >= 0)
+      continue;
+    t = dirmtime(dirs[i].dir);
+    if (t.tv_sec != dirs[i].mtime.tv_sec || t.tv_nsec != dirs[i].mtime.tv_nsec) {
+      dirs[i].mtime = t;
+      stale = 1;
+    }
+  }
+  if (stale)
+    hash_clear();
+}
+
+/*
+ * hash_find - Return the file that runs command name, searching PATH
+ *    on a miss. Returns NULL if there is none. Names with a slash are
+ *    returned as they are; a hit in a relative PATH dir is not
+ *    remembered and is copied into arena a instead.
+ */
+const char *hash_find(struct arena *a, const char *name)
+{
+  struct hashent *ent;
+  struct stat st;
+  char *file;
+  unsigned h;
+  int i;
+
+  if (strchr(name, '/') != NULL)
+    return name;
+
+  h = strhash(name);
+  for (ent = table[h]; ent != NULL; ent = ent->next) {
+    if (strcmp(ent->name, name) == 0) {
+      ent->hits++;
+      return ent->path;
+    }
+  }
+
+  stats_count(ST_PATHMISS);
+  for (i = 0; i < ndirs; i++) {
+    const char *dir = *dirs[i].dir ? dirs[i].dir : ".";
+    file = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(file, "%s/%s", dir, name);
+    if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0) {
+      if (dir[0] != '/') {
+        /* depends on the working directory, so don't remember it */
+        name = strcpy(arena_alloc(a, strlen(file) + 1), file);
+        free(file);
+        return name;
+      }
+      ent = malloc(sizeof(*ent));
+      ent->name = strdup(name);
+      ent->path = file;
+      ent->hits = 1;
+      ent->next = table[h];
+      table[h] = ent;
+      return file;
+    }
+    free(file);
+  }
+  return NULL;
+}
+
+/* hash_clear - Forget every remembered location */
+void hash_clear(void)
+{
+  struct hashent *ent, *next;
+  int i;
+
+  for (i = 0; i < NBUCKETS; i++) {
+    for (ent = table[i]; ent != NULL; ent = next) {
+      next = ent->next;
+      free(ent->name);
+      free(ent->path);
+      free(ent);
+    }
+    table[i] = NULL;
+  }
+}
+
+/* hash_list - Print the remembered locations */
+void hash_list(void)
+{
+  struct hashent *ent;
+  int i, n = 0;
+
+  for (i = 0; i < NBUCKETS; i++) {
+    for (ent = table[i]; ent != NULL; ent = ent->next) {
+      if (n++ == 0)
+        printf("hits\tcommand\n");
+      printf("%4d\t%s\n", ent->hits, ent->path);
+    }
+  }
+  if (n == 0)
+    printf("hash: hash table empty\n");
+}
@@ -0,0 +1,16 @@
+#ifndef FILE_HASH
+#define FILE_HASH
+
+#include "arena.h"
+
+/*
+ * The command hash: remembers where each command was found on PATH so
+ * launching it again is a single execve. hash_check must be called
+ * before a batch of hash_find calls; it throws the table away if PATH
+ * changed or a PATH directory was modified since the last check.
+ */
+void hash_check(void);
+const char *hash_find(struct arena *a, const char *name);
+void hash_clear(void);
+void hash_list(void);
+#endif
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "jobs.h"
+
+#define INITJIDS    16   /* initial size of the jid index */
+#define INITPIDS    16   /* initial number of pid buckets */
+
+/* nomem - the shell can't run without its job list */
+static void nomem(void)
+{
+  fprintf(stdout, "jobs: out of memory\n");
+  exit(1);
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+  ptr = realloc(ptr, size);
+  if (ptr == NULL)
+    nomem();
+  return ptr;
+}
+
+static unsigned pidhash(struct joblist *jobs, pid_t pid)
+{
+  return ((unsigned)pid * 2654435761u) & (jobs->pidcap - 1);
+}
+
+/* growpids - double the pid hash table and rehash every process */
+static void growpids(struct joblist *jobs)
+{
+  struct proc_t **old = jobs->bypid;
+  int oldcap = jobs->pidcap;
+  struct proc_t *proc, *next;
+  int i;
+
+  jobs->pidcap = oldcap * 2;
+  jobs->bypid = calloc(jobs->pidcap, sizeof(*jobs->bypid));
+  if (jobs->bypid == NULL)
+    nomem();
+  for (i = 0; i < oldcap; i++) {
+    for (proc = old[i]; proc != NULL; proc = next) {
+      unsigned h = pidhash(jobs, proc->pid);
+      next = proc->pid_next;
+      proc->pid_next = jobs->bypid[h];
+      jobs->bypid[h] = proc;
+    }
+  }
+  free(old);
+}
+
+/* allocjid - Take a jid from the free list, or a fresh one past maxjid */
+static int allocjid(struct joblist *jobs)
+{
+  int jid;
+
+  while (jobs->nfree > 0) {
+    jid = jobs->freejids[--jobs->nfree];
+    if (jid <= jobs->maxjid)
+      return jid;
+    /* stale: maxjid shrank below it after it was released */
+  }
+  jid = ++jobs->maxjid;
+  if (jid >= jobs->jidcap) {
+    int cap = jobs->jidcap * 2;
+    jobs->byjid = xrealloc(jobs->byjid, cap * sizeof(*jobs->byjid));
+    memset(jobs->byjid + jobs->jidcap, 0,
+        (cap - jobs->jidcap) * sizeof(*jobs->byjid));
+    jobs->freejids = xrealloc(jobs->freejids, cap * sizeof(*jobs->freejids));
+    jobs->jidcap = cap;
+  }
+  return jid;
+}
+
+/* releasejid - Return a jid to the allocator */
+static void releasejid(struct joblist *jobs, int jid)
+{
+  jobs->byjid[jid] = NULL;
+  if (jid == jobs->maxjid) {
+    /* like the original list, numbering restarts after the top job */
+    while (jobs->maxjid > 0 && jobs->byjid[jobs->maxjid] == NULL)
+      jobs->maxjid--;
+  } else {
+    jobs->freejids[jobs->nfree++] = jid;
+  }
+}
+
+/* initjobs - Initialize the job list */
+void initjobs(struct joblist *jobs)
+{
+  memset(jobs, 0, sizeof(*jobs));
+  jobs->jidcap = INITJIDS;
+  jobs->byjid = xrealloc(NULL, INITJIDS * sizeof(*jobs->byjid));
+  memset(jobs->byjid, 0, INITJIDS * sizeof(*jobs->byjid));
+  jobs->freejids = xrealloc(NULL, INITJIDS * sizeof(*jobs->freejids));
+  jobs->pidcap = INITPIDS;
+  jobs->bypid = xrealloc(NULL, INITPIDS * sizeof(*jobs->bypid));
+  memset(jobs->bypid, 0, INITPIDS * sizeof(*jobs->bypid));
+}
+
+/* freejob - Release a job and its processes */
+static void freejob(struct job_t *job)
+{
+  struct proc_t *proc, *next;
+
+  for (proc = job->procs; proc != NULL; proc = next) {
+    next = proc->next;
+    if (proc->pidfd >= 0)
+      close(proc->pidfd);
+    free(proc);
+  }
+  free(job->cmdline);
+  free(job);
+}
+
+/* freejobs - Delete every job and release the list's memory */
+void freejobs(struct joblist *jobs)
+{
+  int jid;
+
+  for (jid = 1; jid <= jobs->maxjid; jid++)
+    if (jobs->byjid[jid] != NULL)
+      freejob(jobs->byjid[jid]);
+  free(jobs->byjid);
+  free(jobs->freejids);
+  free(jobs->bypid);
+  memset(jobs, 0, sizeof(*jobs));
+}
+
+/* maxjid - Returns largest allocated job ID */
+int maxjid(struct joblist *jobs)
+{
+  return jobs->maxjid;
+}
+
+/*
+ * addjob - Add a job with process group pgid to the job list, returns
+ *    the new job. Its processes are added with addproc.
+ */
+struct job_t *addjob(struct joblist *jobs, pid_t pgid, int state, char *cmdline)
+{
+  struct job_t *job;
+
+  if (pgid < 1)
+    return NULL;
+
+  job = xrealloc(NULL, sizeof(*job));
+  memset(job, 0, sizeof(*job));
+  job->pid = pgid;
+  job->jid = allocjid(jobs);
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  job->cmdline = strdup(cmdline);
+  if (job->cmdline == NULL)
+    nomem();
+
+  jobs->byjid[job->jid] = job;
+  jobs->njobs++;
+  setjobstate(jobs, job, state);
+  return job;
+}
+
+/*
+ * addproc - Append a process to a job. pid 0 records a stage that
+ *    could not be started; it counts as exited with status 127.
+ */
+struct proc_t *addproc(struct joblist *jobs, struct job_t *job, pid_t pid)
+{
+  struct proc_t *proc;
+  unsigned h;
+
+  proc = xrealloc(NULL, sizeof(*proc));
+  memset(proc, 0, sizeof(*proc));
+  proc->pid = pid;
+  proc->pidfd = -1;
+  proc->job = job;
+  if (job->lastproc != NULL)
+    job->lastproc->next = proc;
+  else
+    job->procs = proc;
+  job->lastproc = proc;
+
+  if (pid < 1) {
+    proc->done = 1;
+    proc->status = 127 << 8;
+    return proc;
+  }
+  if (jobs->nprocs >= jobs->pidcap)
+    growpids(jobs);
+  h = pidhash(jobs, pid);
+  proc->pid_next = jobs->bypid[h];
+  jobs->bypid[h] = proc;
+  jobs->nprocs++;
+  job->nlive++;
+  return proc;
+}
+
+/*
+ * procdone - Record that a process exited with wait status status.
+ *    Returns how many processes of its job are still alive.
+ */
+int procdone(struct proc_t *proc, int status)
+{
+  if (!proc->done) {
+    proc->done = 1;
+    proc->status = status;
+    proc->job->nlive--;
+  }
+  return proc->job->nlive;
+}
+
+/*
+ * dropproc - Forget a reaped process of a job that goes on, such as a
+ *    finished xargs batch, so a long job doesn't pile them up
+ */
+void dropproc(struct joblist *jobs, struct proc_t *proc)
+{
+  struct job_t *job = proc->job;
+  struct proc_t **pp, *prev = NULL;
+
+  for (pp = &job->procs; *pp != proc; pp = &(*pp)->next)
+    prev = *pp;
+  *pp = proc->next;
+  if (job->lastproc == proc)
+    job->lastproc = prev;
+  if (proc->pid > 0) {
+    for (pp = &jobs->bypid[pidhash(jobs, proc->pid)]; *pp != proc; pp = &(*pp)->pid_next)
+      ;
+    *pp = proc->pid_next;
+    jobs->nprocs--;
+  }
+  if (proc->pidfd >= 0)
+    close(proc->pidfd);
+  free(proc);
+}
+
+/* addusage - Add the resources in u to those in to */
+void addusage(struct usage *to, const struct usage *u)
+{
+  timeradd(&to->utime, &u->utime, &to->utime);
+  timeradd(&to->stime, &u->stime, &to->stime);
+  if (u->maxrss > to->maxrss)
+    to->maxrss = u->maxrss;
+  to->nvcsw += u->nvcsw;
+  to->nivcsw += u->nivcsw;
+}
+
+/*
+ * procusage - Record what a reaped process used, from wait4, and add
+ *    it to its job's total
+ */
+void procusage(struct proc_t *proc, const struct rusage *ru)
+{
+  proc->usage.utime = ru->ru_utime;
+  proc->usage.stime = ru->ru_stime;
+  proc->usage.maxrss = ru->ru_maxrss;
+  proc->usage.nvcsw = ru->ru_nvcsw;
+  proc->usage.nivcsw = ru->ru_nivcsw;
+  addusage(&proc->job->usage, &proc->usage);
+}
+
+/* printusage - Print resource usage on one line, without a newline */
+void printusage(const struct usage *u)
+{
+  printf("user %ld.%03lds sys %ld.%03lds rss %ldK csw %ld+%ld",
+      (long)u->utime.tv_sec, (long)u->utime.tv_usec / 1000,
+      (long)u->stime.tv_sec, (long)u->stime.tv_usec / 1000,
+      u->maxrss, u->nvcsw, u->nivcsw);
+}
+
+/*
+ * liveusage - What a process that is still running has used so far,
+ *    from /proc/PID/stat and /proc/PID/status. Returns 0 if it is gone.
+ */
+static int liveusage(pid_t pid, struct usage *u)
+{
+  char path[64], buf[2048], *p;
+  unsigned long ut, st;
+  long tick = sysconf(_SC_CLK_TCK);
+  int fd, n;
+
+  memset(u, 0, sizeof(*u));
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+  /* the command name may hold spaces, the fields after it can't */
+  if ((p = strrchr(buf, ')')) == NULL ||
+      sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+          &ut, &st) != 2)
+    return 0;
+  u->utime.tv_sec = ut / tick;
+  u->utime.tv_usec = ut % tick * (1000000 / tick);
+  u->stime.tv_sec = st / tick;
+  u->stime.tv_usec = st % tick * (1000000 / tick);
+
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return 1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 1;
+  buf[n] = '\0';
+  if ((p = strstr(buf, "VmHWM:")) != NULL)
+    u->maxrss = strtol(p + 6, NULL, 10);
+  if ((p = strstr(buf, "\nvoluntary_ctxt_switches:")) != NULL)
+    u->nvcsw = strtol(p + 25, NULL, 10);
+  if ((p = strstr(buf, "nonvoluntary_ctxt_switches:")) != NULL)
+    u->nivcsw = strtol(p + 27, NULL, 10);
+  return 1;
+}
+
+/*
+ * jobstatus - Exit status of a finished job: that of its last stage,
+ *    or with pipefail that of the last stage that failed. Helpers for
+ *    <(cmd) and >(cmd) don't count.
+ */
+int jobstatus(struct job_t *job, int pipefail)
+{
+  struct proc_t *proc;
+  int status, ret = 0;
+
+  for (proc = job->procs; proc != NULL; proc = proc->next) {
+    if (proc->helper)
+      continue;
+    status = proc->status;
+    status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+    if (!pipefail || status != 0)
+      ret = status;
+  }
+  return ret;
+}
+
+/* deletejob - Delete the job that process pid belongs to */
+int deletejob(struct joblist *jobs, pid_t pid)
+{
+  struct proc_t **pp, *proc;
+  struct job_t *job = getjobpid(jobs, pid);
+
+  if (job == NULL)
+    return 0;
+
+  for (proc = job->procs; proc != NULL; proc = proc->next) {
+    if (proc->pid < 1)
+      continue;
+    for (pp = &jobs->bypid[pidhash(jobs, proc->pid)]; *pp != proc; pp = &(*pp)->pid_next)
+      ;
+    *pp = proc->pid_next;
+    jobs->nprocs--;
+  }
+  if (jobs->fg == job)
+    jobs->fg = NULL;
+  releasejid(jobs, job->jid);
+  jobs->njobs--;
+  freejob(job);
+  return 1;
+}
+
+/* setjobstate - Change a job's state, keeping track of the FG job */
+void setjobstate(struct joblist *jobs, struct job_t *job, int state)
+{
+  if (jobs->fg == job)
+    jobs->fg = NULL;
+  job->state = state;
+  if (state == FG)
+    jobs->fg = job;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct joblist *jobs)
+{
+  return jobs->fg != NULL ? jobs->fg->pid : 0;
+}
+
+/* getproc - Find a process of any job by its PID */
+struct proc_t *getproc(struct joblist *jobs, pid_t pid)
+{
+  struct proc_t *proc;
+
+  if (pid < 1)
+    return NULL;
+  for (proc = jobs->bypid[pidhash(jobs, pid)]; proc != NULL; proc = proc->pid_next)
+    if (proc->pid == pid)
+      return proc;
+  return NULL;
+}
+
+/* getjobpid  - Find a job (by the PID of any of its processes) */
+struct job_t *getjobpid(struct joblist *jobs, pid_t pid)
+{
+  struct proc_t *proc = getproc(jobs, pid);
+  return proc != NULL ? proc->job : NULL;
+}
+
+/* getjobjid  - Find a job (by JID) on the job list */
+struct job_t *getjobjid(struct joblist *jobs, int jid)
+{
+  if (jid < 1 || jid > jobs->maxjid)
+    return NULL;
+  return jobs->byjid[jid];
+}
+
+/* pid2jid - Map process ID to job ID */
+int pid2jid(struct joblist *jobs, pid_t pid)
+{
+  struct job_t *job = getjobpid(jobs, pid);
+  return job != NULL ? job->jid : 0;
+}
+
+/*
+ * listjobs - Print the job list. With lflag, follow each job with a
+ *    line per process and its running time and totals: what finished
+ *    stages used comes from wait4, running ones are read from /proc.
+ */
+void listjobs(struct joblist *jobs, int lflag)
+{
+  struct job_t *job;
+  struct proc_t *proc;
+  struct usage total, u;
+  struct timespec now;
+  int jid, status;
+
+  for (jid = 1; jid <= jobs->maxjid; jid++) {
+    job = jobs->byjid[jid];
+    if (job == NULL)
+      continue;
+    printf("[%d] (%d) ", job->jid, job->pid);
+    switch (job->state) {
+      case BG:
+        printf("Running ");
+        break;
+      case FG:
+        printf("Foreground ");
+        break;
+      case ST:
+        printf("Stopped ");
+        break;
+      default:
+        printf("listjobs: Internal error: job[%d].state=%d ",
+            jid, job->state);
+    }
+    printf("%s", job->cmdline);
+    if (!lflag)
+      continue;
+
+    total = job->usage;
+    for (proc = job->procs; proc != NULL; proc = proc->next) {
+      printf("    %7d ", proc->pid);
+      if (proc->done) {
+        status = proc->status;
+        if (WIFSIGNALED(status))
+          printf("signal %-3d ", WTERMSIG(status));
+        else
+          printf("exit %-5d ", WEXITSTATUS(status));
+        u = proc->usage;
+      } else {
+        printf("%-10s ", job->state == ST ? "stopped" : "running");
+        if (liveusage(proc->pid, &u))
+          addusage(&total, &u);
+      }
+      printusage(&u);
+      printf("\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("    wall %.3fs ", (now.tv_sec - job->start.tv_sec) +
+        (now.tv_nsec - job->start.tv_nsec) / 1e9);
+    printusage(&total);
+    printf("\n");
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef FILE_JOBS
+#define FILE_JOBS
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/* Job states */
+#define UNDEF 0 /* undefined */
+#define FG 1    /* running in foreground */
+#define BG 2    /* running in background */
+#define ST 3    /* stopped */
+
+struct usage {              /* Resources used by one or more processes */
+  struct timeval utime;     /* user CPU time */
+  struct timeval stime;     /* system CPU time */
+  long maxrss;              /* peak resident set of the biggest, in KiB */
+  long nvcsw;               /* voluntary context switches */
+  long nivcsw;              /* involuntary context switches */
+};
+
+struct xargs;
+
+struct proc_t {             /* One process (pipeline stage) of a job */
+  pid_t pid;                /* 0 if the stage could not be started */
+  int pidfd;                /* refers to it until it is reaped, or -1 */
+  int status;               /* wait status, once done */
+  int done;                 /* reaped, or never started */
+  int helper;               /* a <(cmd) or >(cmd): its status doesn't count */
+  long long rchar, wchar;   /* bytes it read and wrote, from /proc/PID/io */
+  struct usage usage;       /* from wait4, once reaped */
+  struct job_t *job;        /* the job it belongs to */
+  struct proc_t *next;      /* next stage of the same job */
+  struct proc_t *pid_next;  /* next process in the same pid bucket */
+};
+
+struct job_t {              /* The job struct */
+  pid_t pid;                /* job PID, also its process group ID */
+  int jid;                  /* job ID [1, 2, ...] */
+  int state;                /* UNDEF, BG, FG, or ST */
+  char *cmdline;            /* command line, owned by the job */
+  struct proc_t *procs;     /* stages in pipeline order */
+  struct proc_t *lastproc;
+  int nlive;                /* stages not reaped yet */
+  int reported;             /* a termination message was printed */
+  struct timespec start;    /* CLOCK_MONOTONIC when it was added */
+  struct usage usage;       /* sum over the stages reaped so far */
+  struct xargs *xargs;      /* the batches of an xargs job, or NULL */
+};
+
+/*
+ * The job list. Jobs are indexed by jid in a flat array, and their
+ * processes by pid in a chained hash table, so every lookup is O(1).
+ * Released jids go on a free list and are handed out again before new
+ * ones.
+ */
+struct joblist {
+  struct job_t **byjid;     /* jid -> job, slot 0 unused */
+  int jidcap;               /* number of slots in byjid */
+  int maxjid;               /* largest jid in use (or on the free list) */
+  int *freejids;            /* stack of released jids below maxjid */
+  int nfree;
+  struct proc_t **bypid;    /* pid hash buckets */
+  int pidcap;               /* number of buckets, a power of two */
+  int njobs;                /* number of live jobs */
+  int nprocs;               /* number of processes in bypid */
+  struct job_t *fg;         /* the foreground job, if any */
+};
+
+void initjobs(struct joblist *jobs);
+void freejobs(struct joblist *jobs);
+int maxjid(struct joblist *jobs);
+struct job_t *addjob(struct joblist *jobs, pid_t pgid, int state, char *cmdline);
+struct proc_t *addproc(struct joblist *jobs, struct job_t *job, pid_t pid);
+int procdone(struct proc_t *proc, int status);
+void dropproc(struct joblist *jobs, struct proc_t *proc);
+void procusage(struct proc_t *proc, const struct rusage *ru);
+void addusage(struct usage *to, const struct usage *u);
+void printusage(const struct usage *u);
+int jobstatus(struct job_t *job, int pipefail);
+int deletejob(struct joblist *jobs, pid_t pid);
+void setjobstate(struct joblist *jobs, struct job_t *job, int state);
+pid_t fgpid(struct joblist *jobs);
+struct proc_t *getproc(struct joblist *jobs, pid_t pid);
+struct job_t *getjobpid(struct joblist *jobs, pid_t pid);
+struct job_t *getjobjid(struct joblist *jobs, int jid);
+int pid2jid(struct joblist *jobs, pid_t pid);
+void listjobs(struct joblist *jobs, int lflag);
+#endif
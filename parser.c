@@ -1,161 +1,518 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include "parser.h"
 
+static int parse_failed;  /* set by syntax_error while parsing a line */
+static struct arena *node_arena;  /* where parsecmd puts the tree */
+
+/*
+ * syntax_error - report a syntax error; the parse functions keep
+ * going but parsecmd will throw the tree away
+ */
+static void syntax_error(const char *near) {
+  if (!parse_failed)
+    fprintf(stderr, "syntax error near %s\n", near ? near : "end of line");
+  parse_failed = 1;
+}
+
+/*
+ * is_empty - true if cmd runs no program (e.g. one side of "| ls")
+ */
+static int is_empty(struct cmd *cmd) {
+  while (cmd->type == '<' || cmd->type == '>')
+    cmd = ((struct redircmd *)cmd)->cmd;
+  return cmd->type == ' ' && ((struct execcmd *)cmd)->argv[0] == 0;
+}
+
 int is_blank(char c) {
   return strchr(" \n\r\t\v", c) != NULL;
 }
 
 int is_delim(char c) {
-  return c == '<' || c == '>' || c == '|' || c == '&';
+  return c == '<' || c == '>' || c == '|' || c == '&' || c == ';';
+}
+
+/*
+ * Operator tokens. get_tokens hands out pointers into this table, so
+ * the parser can tell an operator from a quoted word like '>' by its
+ * address. The longer ones come first, so they win. The digits are
+ * the fd numbers of redirections like 2> and 2>&1.
+ */
+static char op_tokens[][4] = {
+  "<<<", "<<", ">>", "&&", "||", "&>", ">&", "<", ">", "|", "&", ";",
+  "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+};
+#define NOPS    12  /* the operators before the fd numbers */
+
+int is_op(const char *tok) {
+  return tok >= op_tokens[0] && tok < op_tokens[0] + sizeof(op_tokens);
+}
+
+/* is_ionum - true for the fd number before a redirection */
+int is_ionum(const char *tok) {
+  return tok >= op_tokens[NOPS] && tok < op_tokens[0] + sizeof(op_tokens);
+}
+
+/* is_redirop - true for a redirection operator or its fd number */
+int is_redirop(const char *tok) {
+  return is_op(tok) && (is_ionum(tok) || strchr("<>", tok[0]) || strcmp(tok, "&>") == 0);
+}
+
+/* op_token - the operator that starts at s, which is a delimiter */
+static char *op_token(const char *s) {
+  size_t i, n;
+
+  for (i = 0; i < NOPS; i++) {
+    n = strlen(op_tokens[i]);
+    if (strncmp(s, op_tokens[i], n) == 0)
+      break;
+  }
+  return op_tokens[i];
 }
 
 int is_background(char** argv){
   int n = 0;
   while(argv[n] != NULL) n++;
-  return n != 0 && strcmp(argv[n-1], "&") == 0;
+  return n != 0 && is_op(argv[n-1]) && strcmp(argv[n-1], "&") == 0;
+}
+
+/* is_time - true if the pipeline at argv[n] has a time prefix */
+static int is_time(char **argv, int n) {
+  return argv[n] != NULL && strcmp(argv[n], "time") == 0 &&
+         argv[n + 1] != NULL && !is_op(argv[n + 1]);
+}
+
+/*
+ * is_list - true if the line is more than one pipeline: it has a ;,
+ * && or ||, or an & before its end. A timed pipeline is run as a list
+ * too, so the shell can wait for it.
+ */
+int is_list(char** argv){
+  int n;
+
+  if (is_time(argv, 0))
+    return 1;
+  for (n = 0; argv[n] != NULL; n++)
+    if (is_op(argv[n]) && (strcmp(argv[n], ";") == 0 || strcmp(argv[n], "&&") == 0 ||
+                           strcmp(argv[n], "||") == 0 ||
+                           (strcmp(argv[n], "&") == 0 && argv[n + 1] != NULL)))
+      return 1;
+  return 0;
+}
+
+/* is_listcmd - true for the ;, &, &&, || and time nodes */
+int is_listcmd(struct cmd *cmd) {
+  return cmd->type == ';' || cmd->type == '&' || cmd->type == 'A' || cmd->type == 'O' ||
+         cmd->type == 'T';
 }
 
+/*
+ * token vector, grown by doubling inside the arena
+ */
+struct tokvec {
+  char **argv;
+  int n, cap;
+};
 
-int get_tokens(const char *cmdline, char** argv) {
-  int argc = 0;
-  const char* pc = cmdline;
-  char buf[100];
-  char* pb;
+static void tok_push(struct arena *a, struct tokvec *v, char *tok) {
+  char **argv;
 
-  while(pc != 0) {
-    pb = buf;
-    while(*pc != 0 && is_blank(*pc)) {
-      pc++;
+  if (v->n == v->cap) {
+    v->cap = v->cap ? v->cap * 2 : 16;
+    argv = arena_alloc(a, v->cap * sizeof(char *));
+    if (v->n > 0)
+      memcpy(argv, v->argv, v->n * sizeof(char *));
+    v->argv = argv;
+  }
+  v->argv[v->n++] = tok;
+}
+
+/* is_procsub - true if a <(cmd) or >(cmd) starts at s */
+static int is_procsub(const char *s) {
+  return (s[0] == '<' || s[0] == '>') && s[1] == '(';
+}
+
+/*
+ * copygroup - copysub without the message. A $(...) or ${...} nested
+ *    in it is copied by a call of its own, so its brackets are checked
+ *    too; *inner is set while one of those is being copied.
+ */
+static const char *copygroup(const char *r, char **w, int *inner) {
+  char open = r[1], close = open == '(' ? ')' : '}', q;
+  int depth = 0;
+
+  *(*w)++ = *r++;
+  do {
+    if (*r == '\'' || *r == '"') {
+      q = *r;
+      do
+        *(*w)++ = *r++;
+      while (*r != 0 && *r != q);
     }
+    if (*r == 0)
+      return NULL;
+    if (depth > 0 && *r == '$' && (r[1] == '(' || r[1] == '{')) {
+      *inner = 1;
+      if ((r = copygroup(r, w, inner)) == NULL)
+        return NULL;
+      *inner = 0;
+      continue;
+    }
+    depth += (*r == open) - (*r == close);
+    *(*w)++ = *r++;
+  } while (depth > 0);
+  return r;
+}
+
+/*
+ * copysub - copy the $(...), $((...)), ${...}, <(...) or >(...) at r
+ *    into w as it is, quotes included, so blanks and operators inside
+ *    don't end the word. Returns a pointer past it, or NULL (after
+ *    printing a message) if it, or a $(...) or ${...} in it, is not
+ *    closed.
+ */
+static const char *copysub(const char *r, char **w) {
+  const char *end;
+  int inner = 0;
+
+  if ((end = copygroup(r, w, &inner)) == NULL) {
+    if (inner)
+      fprintf(stderr, "%.*s: bad substitution\n", (int)strcspn(r, "\n"), r);
+    else
+      fprintf(stderr, "unterminated %c%c\n", r[0], r[1]);
+  }
+  return end;
+}
 
-    if (*pc == 0)break;
+/*
+ * get_tokens - split a command line into a NULL terminated argv.
+ *
+ * The words are copied into the arena in a single pass, and '...' or
+ * "..." quote blanks and operators the way parse_line's quotes do
+ * (the quotes themselves are squeezed out). Operators are not copied
+ * at all. A $ is left for the shell to expand when the command runs:
+ * inside quotes it gets a marker byte in front, TOK_LITERAL for '...'
+ * and TOK_QUOTED for "...", and $(...) and ${...} are kept whole.
+ * So are <(...) and >(...), after a TOK_PROCSUB.
+ * A one-digit word right before < or > becomes an fd number, and a
+ * here-document delimiter that had quotes starts with TOK_LITERAL.
+ * Everything is released with the arena.
+ *
+ * Returns NULL (after printing a message) on an unterminated quote.
+ */
+char** get_tokens(struct arena *a, const char *cmdline) {
+  struct tokvec v = { NULL, 0, 0 };
+  size_t len = strlen(cmdline);
+  const char *r = cmdline;
+  char *w, *tok;
+  char q;
+  int quoted;
 
-    while(*pc != 0 && !is_blank(*pc)) {
-      if (is_delim(*pc)) {
-        if ( pb == buf ) {
-          *pb = *pc;
-          pb++; pc++;
+  /* room for a marker before each $ (or <( or >() */
+  for (tok = strpbrk(cmdline, "$<>"); tok != NULL; tok = strpbrk(tok + 1, "$<>"))
+    len++;
+  w = arena_alloc(a, len + 1);
+
+  while (1) {
+    while (*r != 0 && is_blank(*r))
+      r++;
+    if (*r == 0)
+      break;
+    if (is_delim(*r) && !is_procsub(r)) {
+      tok = op_token(r);
+      tok_push(a, &v, tok);
+      r += strlen(tok);
+      continue;
+    }
+
+    tok = w;
+    quoted = 0;
+    while (*r != 0 && !is_blank(*r) && (!is_delim(*r) || is_procsub(r))) {
+      if (*r == '\'' || *r == '"') {
+        quoted = 1;
+        q = *r++;
+        while (*r != 0 && *r != q) {
+          if (*r != '$') {
+            *w++ = *r++;
+            continue;
+          }
+          *w++ = q == '"' ? TOK_QUOTED : TOK_LITERAL;
+          if (q == '"' && (r[1] == '(' || r[1] == '{')) {
+            if ((r = copysub(r, &w)) == NULL)
+              return NULL;
+          } else {
+            *w++ = *r++;
+          }
         }
-        break;
+        if (*r == 0) {
+          fprintf(stderr, "unterminated %c quote\n", q);
+          return NULL;
+        }
+        r++;
+      } else if (*r == '$' && (r[1] == '(' || r[1] == '{')) {
+        if ((r = copysub(r, &w)) == NULL)
+          return NULL;
+      } else if (is_procsub(r)) {
+        *w++ = TOK_PROCSUB;
+        if ((r = copysub(r, &w)) == NULL)
+          return NULL;
+      } else {
+        *w++ = *r++;
       }
-      *pb = *pc;
-      pb++; pc++;
     }
-    *pb = 0;
-    int len = pb - buf + 1;
-    argv[argc] = (char*)malloc(len);
-    /*
-     * strncpy will copy trailing '\0'
-     */
-    strncpy(argv[argc], buf, len);
-    argc++;
+    *w++ = 0;
+    if (!quoted && w - tok == 2 && isdigit((unsigned char)*tok) &&
+        (*r == '<' || *r == '>') && !is_procsub(r)) {
+      /* 2> and the like: the word is an fd number */
+      tok = op_tokens[NOPS + *tok - '0'];
+    } else if (quoted && v.n > 0 && is_op(v.argv[v.n - 1]) && strcmp(v.argv[v.n - 1], "<<") == 0) {
+      /* a quoted here-document delimiter: the text is not expanded;
+         the quotes took up more room than the marker */
+      memmove(tok + 1, tok, w - tok);
+      *tok = TOK_LITERAL;
+      w++;
+    }
+    tok_push(a, &v, tok);
   }
-  argv[argc] = NULL;
-  return 0;
+  tok_push(a, &v, NULL);
+  return v.argv;
 }
 
-struct cmd* parsecmd(char** argv) {
+/*
+ * parsecmd - build the command tree for a line of tokens.
+ * The nodes are bump-allocated in arena a, next to the tokens, and go
+ * away with them. Returns NULL (after printing a message) if the line
+ * is malformed.
+ */
+struct cmd* parsecmd(struct arena *a, char** argv) {
   struct cmd *cmd;
   int p = 0;
+  node_arena = a;
+  parse_failed = 0;
   cmd = parseline(&p, argv);
-  if (argv[p] != NULL) {
+  if (!parse_failed && argv[p] != NULL) {
     fprintf(stderr, "leftover %s...\n", argv[p]);
-    exit(-1);
+    parse_failed = 1;
   }
-  return cmd;
+  return parse_failed ? NULL : cmd;
 }
 
+/*
+ * parseline - and-or lists separated by ; or &. a & b runs a in the
+ * background and goes on with b; a trailing ; or & has no right side.
+ */
 struct cmd* parseline(int *no, char** argv) {
   struct cmd *cmd;
+  char *tok;
+
+  cmd = parseandor(no, argv);
+  if (peek(no, argv, ";&")) {
+    tok = argv[*no];
+    if (is_empty(cmd))
+      syntax_error(tok);
+    *no += 1;
+    if (argv[*no] != NULL)
+      cmd = make_listcmd(tok[0], cmd, parseline(no, argv));
+    else if (tok[0] == '&')
+      cmd = make_listcmd('&', cmd, NULL);
+  }
+  return cmd;
+}
+
+/*
+ * parseandor - pipelines joined by && and ||, which bind equally
+ * tight and group from the left
+ */
+struct cmd* parseandor(int *no, char** argv) {
+  struct cmd *cmd;
+  char *tok;
+
   cmd = parsepipe(no, argv);
+  while (peekop(no, argv, "&&") || peekop(no, argv, "||")) {
+    tok = argv[*no];
+    if (is_empty(cmd))
+      syntax_error(tok);
+    *no += 1;
+    cmd = make_listcmd(tok[0] == '&' ? 'A' : 'O', cmd, parsepipe(no, argv));
+    if (is_empty(((struct listcmd *)cmd)->right))
+      syntax_error(argv[*no]);
+  }
   return cmd;
 }
 
+/*
+ * parsepipe - stages joined by |. A leading time word makes a 'T'
+ * node around the whole pipeline, wherever the pipeline is.
+ */
 struct cmd* parsepipe(int *no, char** argv) {
   struct cmd *cmd;
+
+  if (is_time(argv, *no)) {
+    *no += 1;
+    return make_listcmd('T', parsepipe(no, argv), NULL);
+  }
   cmd = parseexec(no, argv);
   if (peek(no, argv, "|")) {
+    if (is_empty(cmd))
+      syntax_error("|");
     *no += 1;
     cmd = make_pipecmd(cmd, parsepipe(no, argv));
+    if (is_empty(((struct pipecmd *)cmd)->right))
+      syntax_error(argv[*no]);
   }  
   return cmd;
 }
 
+/*
+ * addredir - put redirection r under the ones already around cmd, so
+ * they stay in the order they were written
+ */
+static struct cmd* addredir(struct cmd *cmd, struct redircmd *r) {
+  struct redircmd *p;
+
+  if (cmd->type == ' ') {
+    r->cmd = cmd;
+    return (struct cmd*)r;
+  }
+  for (p = (struct redircmd *)cmd; p->cmd->type != ' '; p = (struct redircmd *)p->cmd)
+    ;
+  r->cmd = p->cmd;
+  p->cmd = (struct cmd*)r;
+  return cmd;
+}
+
+/*
+ * parseredirs - [n]< [n]> [n]>> [n]<< [n]<<< [n]>&m and &>, each with
+ * its word. The word after << is the text of the here-document,
+ * which the shell read in place of the delimiter; a here-string gets
+ * a newline added. &> file is > file 2>&1.
+ */
 struct cmd* parseredirs(struct cmd *cmd, int *no, char** argv) {
-  while(peek(no, argv, "<>")) {
-    int tok = argv[*no][0];
+  struct redircmd *r;
+  char *op, *word;
+  size_t len;
+  int fd;
+
+  while (argv[*no] != NULL && is_redirop(argv[*no])) {
+    fd = -1;
+    if (is_ionum(argv[*no]))
+      fd = argv[(*no)++][0] - '0';
+    op = argv[*no];
+    if (op == NULL || !is_redirop(op) || is_ionum(op) || (fd >= 0 && op[0] == '&')) {
+      syntax_error(op);
+      break;
+    }
     *no += 1;
-    // 
-    switch(tok) {
-      case '<':
-        cmd = make_redircmd(cmd, argv[*no], '<');
-        break;
-      case '>':
-        cmd = make_redircmd(cmd, argv[*no], '>');
-        break;
+    word = argv[*no];
+    if (word == NULL || is_op(word)) {
+      syntax_error(word);
+      break;
     }
     *no += 1;
+
+    r = (struct redircmd *)make_redircmd(cmd, word, op[0] == '<' ? '<' : '>');
+    if (strcmp(op, ">>") == 0) {
+      r->mode = O_WRONLY | O_CREAT | O_APPEND;
+    } else if (strcmp(op, "<<") == 0) {
+      r->how = 'h';
+    } else if (strcmp(op, "<<<") == 0) {
+      r->how = 'h';
+      len = strlen(word);
+      r->file = arena_alloc(node_arena, len + 2);
+      memcpy(r->file, word, len);
+      strcpy(r->file + len, "\n");
+    } else if (strcmp(op, ">&") == 0) {
+      if (!isdigit((unsigned char)word[0]) || word[1] != 0) {
+        syntax_error(word);
+        break;
+      }
+      r->how = '&';
+      r->dupfd = word[0] - '0';
+    }
+    if (fd >= 0)
+      r->fd = fd;
+    cmd = addredir(cmd, r);
+    if (strcmp(op, "&>") == 0) {
+      r = (struct redircmd *)make_redircmd(cmd, "1", '>');
+      r->how = '&';
+      r->fd = 2;
+      r->dupfd = 1;
+      cmd = addredir(cmd, r);
+    }
   }
   return cmd;
 }
 
+/*
+ * arg_push - append a word to cmd's argv, moving it out of the node
+ * into a bigger vector in the arena when the inline slots run out
+ */
+static void arg_push(struct execcmd *cmd, char *arg) {
+  char **argv;
+
+  if (cmd->argc + 1 == cmd->cap) {
+    cmd->cap *= 2;
+    argv = arena_alloc(node_arena, cmd->cap * sizeof(char *));
+    memcpy(argv, cmd->argv, cmd->argc * sizeof(char *));
+    cmd->argv = argv;
+  }
+  cmd->argv[cmd->argc++] = arg;
+  cmd->argv[cmd->argc] = 0;
+}
+
 struct cmd* parseexec(int *no, char** argv) {
-  int argc;
   struct execcmd *cmd;
   struct cmd *ret;
-  int first_ch;
+  char *tok;
 
   ret = make_cmd();
   cmd = (struct execcmd*)ret;
 
-  argc = 0;
   ret = parseredirs(ret, no, argv);
-  while(!peek(no, argv, "|")) {
-    if (argv[*no]  == NULL) break;
-    first_ch = argv[*no][0];
-    if (is_delim( first_ch ) && first_ch != '&') {
-      fprintf(stderr, "syntax error\n");
-      exit(-1);
-    }
-
-    /**
-     * & is not the argument of command
-     */
-    if (first_ch != '&') {
-      cmd->argv[argc] = argv[*no];
-      argc++;
-    }
+  /* any other operator ends the command; the callers sort it out */
+  while(argv[*no] != NULL && !is_op(argv[*no])) {
+    tok = argv[*no];
+    arg_push(cmd, tok);
     *no += 1;
     ret = parseredirs(ret, no, argv);
   }
-  cmd->argv[argc] = 0;
   return ret;
 }
 
+/* peek - true if the next token is a one-character operator in str */
 int peek(int *no, char** argv, char *str) {
-  return argv[*no] != NULL && strchr(str, argv[*no][0]);
+  return argv[*no] != NULL && is_op(argv[*no]) && argv[*no][1] == 0 &&
+         strchr(str, argv[*no][0]);
+}
+
+/* peekop - true if the next token is the operator op */
+int peekop(int *no, char** argv, char *op) {
+  return argv[*no] != NULL && is_op(argv[*no]) && strcmp(argv[*no], op) == 0;
 }
 
 struct cmd* make_cmd(void) {
   struct execcmd *cmd;
-  cmd = malloc(sizeof(*cmd));
+  cmd = arena_alloc(node_arena, sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = ' ';
+  cmd->argv = cmd->args;
+  cmd->cap = NARGINLINE;
   return (struct cmd*)cmd;
 }
 
 struct cmd* make_redircmd(struct cmd *subcmd, char *file, int type) {
   struct redircmd *cmd;
-  cmd = malloc(sizeof(*cmd));
+  cmd = arena_alloc(node_arena, sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = type;
   cmd->cmd = subcmd;
   cmd->file = file;
   cmd->mode = (type == '<') ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC;
   cmd->fd = (type == '<') ? 0: 1;
+  cmd->how = 'f';
   return (struct cmd*)cmd;
 }
 
@@ -163,7 +520,7 @@ struct cmd* make_pipecmd(struct cmd *left, struct cmd *right)
 {
   struct pipecmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
+  cmd = arena_alloc(node_arena, sizeof(*cmd));
   memset(cmd, 0, sizeof(*cmd));
   cmd->type = '|';
   cmd->left = left;
@@ -171,13 +528,16 @@ struct cmd* make_pipecmd(struct cmd *left, struct cmd *right)
   return (struct cmd*)cmd;
 }
 
+struct cmd* make_listcmd(int type, struct cmd *left, struct cmd *right)
+{
+  struct listcmd *cmd;
 
-void token_clear(char** argv){
-  int c = 0;
-  while(argv[c] != NULL) {
-    free(argv[c]);
-    c++;
-  }
+  cmd = arena_alloc(node_arena, sizeof(*cmd));
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->type = type;
+  cmd->left = left;
+  cmd->right = right;
+  return (struct cmd*)cmd;
 }
 
 void token_dump(char** argv){
@@ -193,6 +553,7 @@ void cmd_dump(struct cmd* cmd) {
   struct execcmd *ecmd;
   struct pipecmd *pcmd;
   struct redircmd *rcmd;
+  struct listcmd *lcmd;
 
   if (cmd == 0) return;
 
@@ -210,7 +571,11 @@ void cmd_dump(struct cmd* cmd) {
       rcmd = (struct redircmd *)cmd;
       printf("( ");
       cmd_dump(rcmd->cmd);
-      printf("%c %s fd=%d", rcmd->fd ? '>' : '<', rcmd->file, rcmd->fd);
+      if (rcmd->how == '&')
+        printf("%d>&%d", rcmd->fd, rcmd->dupfd);
+      else
+        printf("%c%s %s fd=%d", cmd->type, rcmd->how == 'h' ? "<" :
+               rcmd->mode & O_APPEND ? ">" : "", rcmd->file, rcmd->fd);
       printf(" )");
       break;
     case '|':
@@ -222,6 +587,26 @@ void cmd_dump(struct cmd* cmd) {
       cmd_dump(pcmd->right);
       printf(" )");
       break;
+    case 'T':
+      printf("time { ");
+      cmd_dump(((struct listcmd *)cmd)->left);
+      printf(" }");
+      break;
+    case ';':
+    case '&':
+    case 'A':
+    case 'O':
+      lcmd = (struct listcmd *)cmd;
+      printf("{ ");
+      cmd_dump(lcmd->left);
+      printf(" } %s ", cmd->type == 'A' ? "&&" : cmd->type == 'O' ? "||" :
+                       cmd->type == ';' ? ";" : "&");
+      if (lcmd->right == NULL)
+        break;
+      printf("{ ");
+      cmd_dump(lcmd->right);
+      printf(" }");
+      break;
   }
 
 }
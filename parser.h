@@ -1,23 +1,46 @@
 #ifndef FILE_PARSER
 #define FILE_PARSER
 
-#define MAXARGUS 10
+#include "arena.h"
+
+#define NARGINLINE 8  /* argv slots inside the node, NULL included */
+#define TOK_LITERAL '\001' /* before a $ that was in '...': not expanded */
+#define TOK_QUOTED  '\002' /* before a $ that was in "...": not split */
+#define TOK_PROCSUB '\003' /* before a <(cmd) or >(cmd), kept whole */
 
 struct cmd {
   int type;
 };
 
+/*
+ * argv starts out as the slots inside the node, so a typical command
+ * costs no allocation beyond the node itself. A longer one moves to a
+ * vector in the same arena, doubled as it fills; only ARG_MAX limits
+ * it.
+ */
 struct execcmd {
   int type;
-  char *argv[MAXARGUS];
+  char **argv;     // NULL terminated
+  int argc;
+  int cap;         // slots in argv, including the NULL
+  const char *path; // program to run, filled in by the shell
+  char *args[NARGINLINE];
 };
 
+/*
+ * A redirection of fd, type '<' or '>'. how is 'f' to open file with
+ * mode, 'h' to read the here-document or here-string text in file,
+ * or '&' to make fd a copy of dupfd (2>&1). The outermost node is the
+ * first one written, and they are applied outermost first.
+ */
 struct redircmd {
   int type;
   struct cmd* cmd;
   char *file; // input/ooutput name
   int mode;
   int fd;  // file descriptor number
+  int how;
+  int dupfd;
 };
 
 struct pipecmd {
@@ -26,22 +49,40 @@ struct pipecmd {
   struct cmd *right;
 };
 
-int get_tokens(const char *cmdline, char** argv);
+/*
+ * a ; b, a & b (a runs in the background), a && b (type 'A') and
+ * a || b (type 'O'). right is NULL after a trailing ; or &. A time
+ * prefix is type 'T', with the pipeline as left and no right.
+ */
+struct listcmd {
+  int type;
+  struct cmd *left;
+  struct cmd *right;
+};
+
+char** get_tokens(struct arena *a, const char *cmdline);
 int is_blank(char c);
 int is_delim(char c);
+int is_op(const char *tok);
+int is_ionum(const char *tok);
+int is_redirop(const char *tok);
 int is_background(char** argv);
+int is_list(char** argv);
+int is_listcmd(struct cmd *cmd);
 void token_dump(char** argv);
-void token_clear(char** argv);
 void cmd_dump(struct cmd* cmd);
 
 int fork1();
 int peek(int *no, char** argv, char *str);
-struct cmd* parsecmd(char** argv);
+int peekop(int *no, char** argv, char *op);
+struct cmd* parsecmd(struct arena *a, char** argv);
 struct cmd* parseline(int *no, char** argv);
+struct cmd* parseandor(int *no, char** argv);
 struct cmd* parsepipe(int *no, char** argv);
 struct cmd* parseexec(int *no, char** argv);
 struct cmd* parseredirs(struct cmd *cmd, int *no, char** argv);
 struct cmd* make_cmd(void);
 struct cmd* make_redircmd(struct cmd *subcmd, char *file, int type);
 struct cmd* make_pipecmd(struct cmd *left, struct cmd *right);
+struct cmd* make_listcmd(int type, struct cmd *left, struct cmd *right);
 #endif
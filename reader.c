@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "reader.h"
+
+#define READSIZE    65536    /* bytes asked for per read */
+
+static void *xrealloc(void *ptr, size_t size)
+{
+  ptr = realloc(ptr, size);
+  if (ptr == NULL) {
+    fprintf(stdout, "reader: out of memory\n");
+    exit(1);
+  }
+  return ptr;
+}
+
+/* reader_open - read lines from file descriptor fd */
+void reader_open(struct reader *r, int fd)
+{
+  r->fd = fd;
+  r->size = READSIZE + 2;
+  r->buf = xrealloc(NULL, r->size);
+  r->start = r->scan = r->end = 0;
+  r->held = '\0';
+  r->wait = NULL;
+}
+
+/* reader_string - read lines from a copy of str */
+void reader_string(struct reader *r, const char *str)
+{
+  size_t len = strlen(str);
+
+  r->fd = -1;
+  r->size = len + 2;
+  r->buf = xrealloc(NULL, r->size);
+  memcpy(r->buf, str, len);
+  r->start = r->scan = 0;
+  r->end = len;
+  r->held = '\0';
+  r->wait = NULL;
+}
+
+/*
+ * reader_line - the next line, always ending in a newline, or NULL at
+ *    end of input. The line lives in the reader's buffer and is good
+ *    until the next call.
+ */
+char *reader_line(struct reader *r)
+{
+  char *nl, *line;
+  ssize_t n;
+
+  if (r->held != '\0') {
+    r->buf[r->start] = r->held;
+    r->held = '\0';
+  }
+
+  while ((nl = memchr(r->buf + r->scan, '\n', r->end - r->scan)) == NULL) {
+    if (r->fd < 0) {
+      if (r->start == r->end)
+        return NULL;
+      /* last line without a newline; room for two was kept */
+      nl = r->buf + r->end++;
+      *nl = '\n';
+      break;
+    }
+
+    /* move the partial line to the front, grow if it fills the buffer */
+    if (r->start > 0) {
+      memmove(r->buf, r->buf + r->start, r->end - r->start);
+      r->end -= r->start;
+      r->start = 0;
+    }
+    if (r->size - r->end < READSIZE / 2 + 2) {
+      r->size *= 2;
+      r->buf = xrealloc(r->buf, r->size);
+    }
+    r->scan = r->end;
+
+    /* we may block: let whatever was printed so far out first */
+    fflush(stdout);
+    if (r->wait != NULL)
+      r->wait();
+    n = read(r->fd, r->buf + r->end, r->size - r->end - 2);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      if (n < 0)
+        fprintf(stdout, "read error: %s\n", strerror(errno));
+      r->fd = -1;
+      continue;
+    }
+    r->end += n;
+  }
+
+  line = r->buf + r->start;
+  r->start = r->scan = nl + 1 - r->buf;
+  r->held = r->buf[r->start];
+  r->buf[r->start] = '\0';
+  return line;
+}
+
+/*
+ * reader_rest - everything read but not handed out yet, for a command
+ *    that takes the rest of the input over; *len is set to its size.
+ *    It is good until the next call, and is not NUL-terminated.
+ */
+char *reader_rest(struct reader *r, size_t *len)
+{
+  char *rest;
+
+  if (r->held != '\0') {
+    r->buf[r->start] = r->held;
+    r->held = '\0';
+  }
+  rest = r->buf + r->start;
+  *len = r->end - r->start;
+  r->start = r->scan = r->end;
+  return rest;
+}
+
+/* reader_close - release the buffer (the fd is the caller's) */
+void reader_close(struct reader *r)
+{
+  free(r->buf);
+  r->buf = NULL;
+  r->fd = -1;
+}
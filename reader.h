@@ -0,0 +1,27 @@
+#ifndef FILE_READER
+#define FILE_READER
+
+#include <stddef.h>
+
+/*
+ * A line reader over a file descriptor (or a string, for tsh -c). It
+ * reads in big blocks, hands out lines of any length in place, and
+ * flushes stdout only when it is about to block for more input.
+ */
+struct reader {
+  int fd;                   /* -1 once the input is exhausted */
+  char *buf;
+  size_t size;              /* bytes allocated */
+  size_t start;             /* first byte not handed out yet */
+  size_t scan;              /* bytes before this have no newline */
+  size_t end;               /* end of the data read so far */
+  char held;                /* byte under the last line's terminator */
+  void (*wait)(void);       /* if set, called before a read may block */
+};
+
+void reader_open(struct reader *r, int fd);
+void reader_string(struct reader *r, const char *str);
+char *reader_line(struct reader *r);
+char *reader_rest(struct reader *r, size_t *len);
+void reader_close(struct reader *r);
+#endif
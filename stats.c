@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#define NBUCKETS    40   /* bucket i holds [2^i, 2^(i+1)) ns, up to ~18 min */
+
+struct histogram {
+  long count;
+  long long total;          /* ns */
+  long long max;            /* ns */
+  long buckets[NBUCKETS];
+};
+
+static struct histogram phases[NPHASES];
+static long counters[NCOUNTERS];
+
+static const char *phase_names[NPHASES] = {
+  "tokenize", "parse", "builtin", "spawn", "fork", "wait", "task",
+  "taskcpu"
+};
+static const char *counter_names[NCOUNTERS] = {
+  "lines", "builtins", "spawns", "forks", "pathmiss", "reaped",
+  "envbuilds"
+};
+
+/* stats_now - the monotonic clock, in ns */
+long long stats_now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/*
+ * stats_time - record that phase took from start until now, and
+ *    return now, so back to back phases can share a clock read
+ */
+long long stats_time(int phase, long long start)
+{
+  long long now = stats_now();
+
+  stats_add(phase, now - start);
+  return now;
+}
+
+/* stats_add - record one sample of ns for phase */
+void stats_add(int phase, long long ns)
+{
+  struct histogram *h = &phases[phase];
+  int b = 63 - __builtin_clzll(ns | 1);
+
+  if (b >= NBUCKETS)
+    b = NBUCKETS - 1;
+  h->buckets[b]++;
+  h->count++;
+  h->total += ns;
+  if (ns > h->max)
+    h->max = ns;
+}
+
+/* stats_count - count one event */
+void stats_count(int counter)
+{
+  counters[counter]++;
+}
+
+/* stats_reset - start counting from zero */
+void stats_reset(void)
+{
+  memset(phases, 0, sizeof(phases));
+  memset(counters, 0, sizeof(counters));
+}
+
+/*
+ * percentile - the upper bound of the bucket holding the p-th
+ *    percentile, capped at the largest value seen; 0 if empty
+ */
+static long long percentile(struct histogram *h, int p)
+{
+  long want = (h->count * p + 99) / 100, seen = 0;
+  long long bound;
+  int b;
+
+  if (h->count == 0)
+    return 0;
+  for (b = 0; b < NBUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= want && seen > 0)
+      break;
+  }
+  bound = 2LL << b;
+  return bound < h->max ? bound : h->max;
+}
+
+/* stats_print - a table for people, times in microseconds */
+void stats_print(FILE *fp)
+{
+  struct histogram *h;
+  int i;
+
+  fprintf(fp, "%-9s %9s %12s %10s %10s %10s %10s\n", "phase", "count",
+      "total(us)", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+  for (i = 0; i < NPHASES; i++) {
+    h = &phases[i];
+    fprintf(fp, "%-9s %9ld %12.1f %10.1f %10.1f %10.1f %10.1f\n",
+        phase_names[i], h->count, h->total / 1e3,
+        h->count ? h->total / 1e3 / h->count : 0.0,
+        percentile(h, 50) / 1e3, percentile(h, 99) / 1e3, h->max / 1e3);
+  }
+  for (i = 0; i < NCOUNTERS; i++)
+    fprintf(fp, "%s%s %ld", i ? "  " : "", counter_names[i], counters[i]);
+  fprintf(fp, "\n");
+}
+
+/*
+ * stats_json - everything as one JSON object, for scripts. Buckets
+ *    are keyed by their upper bound in ns; empty ones are left out.
+ */
+void stats_json(FILE *fp)
+{
+  struct histogram *h;
+  int i, b, n;
+
+  fprintf(fp, "{\"counters\":{");
+  for (i = 0; i < NCOUNTERS; i++)
+    fprintf(fp, "%s\"%s\":%ld", i ? "," : "", counter_names[i], counters[i]);
+  fprintf(fp, "},\"phases\":{");
+  for (i = 0; i < NPHASES; i++) {
+    h = &phases[i];
+    fprintf(fp, "%s\"%s\":{\"count\":%ld,\"total_ns\":%lld,\"max_ns\":%lld,"
+        "\"p50_ns\":%lld,\"p99_ns\":%lld,\"buckets\":{", i ? "," : "",
+        phase_names[i], h->count, h->total, h->max,
+        percentile(h, 50), percentile(h, 99));
+    for (b = 0, n = 0; b < NBUCKETS; b++)
+      if (h->buckets[b] > 0)
+        fprintf(fp, "%s\"%lld\":%ld", n++ ? "," : "", 2LL << b, h->buckets[b]);
+    fprintf(fp, "}}");
+  }
+  fprintf(fp, "}}\n");
+}
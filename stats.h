@@ -0,0 +1,43 @@
+#ifndef FILE_STATS
+#define FILE_STATS
+
+#include <stdio.h>
+
+/*
+ * Where the shell's time goes: a log2 histogram of the latency of each
+ * phase of running a command, and of the wall and CPU time of each run
+ * of xargs and parallel, plus event counters. Timestamps come
+ * from CLOCK_MONOTONIC through the vDSO, so timing a phase costs two
+ * clock reads and no system call.
+ */
+enum {
+  PH_TOKENIZE,              /* get_tokens */
+  PH_PARSE,                 /* parsecmd */
+  PH_BUILTIN,               /* a builtin run in the shell */
+  PH_SPAWN,                 /* posix_spawn of one stage, until exec */
+  PH_FORK,                  /* fork of one stage, in the parent */
+  PH_WAIT,                  /* waiting for a foreground job, or in wait */
+  PH_TASK,                  /* an xargs or parallel run, start to reap */
+  PH_TASKCPU,               /* its user plus system CPU time */
+  NPHASES
+};
+
+enum {
+  ST_LINES,                 /* command lines run */
+  ST_BUILTINS,              /* builtins run in the shell */
+  ST_SPAWNS,                /* children started with posix_spawn */
+  ST_FORKS,                 /* children started with fork */
+  ST_PATHMISS,              /* commands looked up in PATH, not the hash */
+  ST_REAPED,                /* children reaped */
+  ST_ENVBUILDS,             /* times the exported variables became a new envp */
+  NCOUNTERS
+};
+
+long long stats_now(void);
+long long stats_time(int phase, long long start);
+void stats_add(int phase, long long ns);
+void stats_count(int counter);
+void stats_reset(void);
+void stats_print(FILE *fp);
+void stats_json(FILE *fp);
+#endif
@@ -0,0 +1,548 @@
+/*
+ * tcheck.c - Regression and soak runner for the shell
+ *
+ * usage: tcheck [-u] [-j jobs] [-s shell] [-d driver] [-o report] trace...
+ *        tcheck -S [-n commands] [-r KiB] [-s shell] [-o report]
+ *
+ * Check mode runs each trace under tdriver, up to -j at a time (one per
+ * online CPU by default), each in its own temporary directory with the
+ * helper programs linked in, so traces that write files cannot see one
+ * another. The output, with pids and ps rows masked, must match the
+ * trace's .out file next to it; -u writes the .out files instead.
+ *
+ * Soak mode feeds one shell -n mixed command lines (builtins, pipelines,
+ * redirections, background jobs; a million by default). Every hundredth
+ * of the way it waits for the shell to catch up and samples its resident
+ * set and open fds. After the first sample, the fd count must not change
+ * and the resident set must not grow by more than -r KiB (512).
+ *
+ * Both modes print a report, to -o as well if given, and exit with 1 if
+ * anything failed.
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLES     100  /* soak samples over the whole run */
+
+struct run {                /* One trace being checked */
+  char *trace;              /* as given */
+  char dir[64];             /* its temporary directory */
+  pid_t pid;                /* the driver, while it runs */
+  long long start, ms;
+  int status;
+};
+
+/* Global variables */
+static char shell[PATH_MAX] = "./tsh";
+static char driver[PATH_MAX] = "./tdriver";
+static FILE *report;        /* -o, or NULL */
+static int update;          /* -u: write the .out files */
+
+/* Helper programs the traces run from the current directory */
+static const char *helpers[] = { "myspin", "mysplit", "mystop", "myint" };
+
+/* What soak mode runs, round robin */
+static const char *mix[] = {
+  "echo hello world",
+  "printf '%s %d\\n' soak 1",
+  "test -d .",
+  "[ 1 -lt 2 ]",
+  "true",
+  "false",
+  "pwd",
+  "jobs",
+  "cd .",
+  "hash",
+  "echo to a file > out",
+  "cat < out",
+  "echo through | cat",
+  "/bin/cat < out | /bin/cat | /bin/cat > out2",
+  "/bin/true &",
+  "./nosuchcommand",
+};
+
+/* Function prototypes */
+static void usage(void);
+static void out(const char *fmt, ...);
+static long long now(void);
+static void absolute(char *path, const char *name);
+static int check(char **traces, int ntraces, int jobs);
+static void startrun(struct run *r);
+static int finishrun(struct run *r);
+static int mask(const char *from, const char *to);
+static int soak(long ncmds, long slack);
+static int catchup(int tofd, int fromfd, char *cmds, size_t len, long mark);
+static void sample(pid_t pid, long *rss, int *fds);
+static void cleanup(const char *dir);
+
+/*
+ * main - parse the options and run one of the modes
+ */
+int main(int argc, char **argv)
+{
+  int c, soakmode = 0, jobs = sysconf(_SC_NPROCESSORS_ONLN), failed;
+  long ncmds = 1000000, slack = 512;
+  char *reportfile = NULL;
+
+  while ((c = getopt(argc, argv, "huSj:n:r:s:d:o:")) != EOF) {
+    switch (c) {
+      case 'u': update = 1; break;
+      case 'S': soakmode = 1; break;
+      case 'j': jobs = atoi(optarg); break;
+      case 'n': ncmds = atol(optarg); break;
+      case 'r': slack = atol(optarg); break;
+      case 's': snprintf(shell, sizeof(shell), "%s", optarg); break;
+      case 'd': snprintf(driver, sizeof(driver), "%s", optarg); break;
+      case 'o': reportfile = optarg; break;
+      default: usage();
+    }
+  }
+  if ((!soakmode && optind == argc) || jobs < 1 || ncmds < SAMPLES)
+    usage();
+  absolute(shell, shell);
+  absolute(driver, driver);
+  if (reportfile && (report = fopen(reportfile, "w")) == NULL) {
+    perror(reportfile);
+    exit(1);
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  if (soakmode)
+    failed = soak(ncmds, slack);
+  else
+    failed = check(argv + optind, argc - optind, jobs);
+  if (report)
+    fclose(report);
+  return failed;
+}
+
+/*
+ * check - run the traces, jobs at a time. Returns 1 if any failed.
+ */
+static int check(char **traces, int ntraces, int jobs)
+{
+  struct run *runs;
+  long long start = now();
+  int next = 0, running = 0, failed = 0, status, i;
+  pid_t pid;
+
+  if ((runs = calloc(ntraces, sizeof(*runs))) == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  while (next < ntraces || running > 0) {
+    if (next < ntraces && running < jobs) {
+      runs[next].trace = traces[next];
+      startrun(&runs[next++]);
+      running++;
+      continue;
+    }
+    if ((pid = wait(&status)) < 0) {
+      perror("wait");
+      exit(1);
+    }
+    for (i = 0; i < next && runs[i].pid != pid; i++)
+      ;
+    if (i == next)
+      continue;
+    runs[i].ms = now() - runs[i].start;
+    runs[i].status = status;
+    runs[i].pid = 0;
+    running--;
+  }
+
+  /* in the order given, so reports from two runs line up */
+  for (i = 0; i < ntraces; i++)
+    failed += finishrun(&runs[i]);
+  out("tcheck: %d traces, %d %s, %d failed, %lld ms\n", ntraces,
+      ntraces - failed, update ? "updated" : "passed", failed, now() - start);
+  free(runs);
+  return failed > 0;
+}
+
+/*
+ * startrun - make a directory for a trace and start the driver in it,
+ *    with its output going to a file there
+ */
+static void startrun(struct run *r)
+{
+  char trace[PATH_MAX], from[PATH_MAX], to[128];
+  int i, fd;
+
+  snprintf(r->dir, sizeof(r->dir), "/tmp/tcheck.XXXXXX");
+  if (mkdtemp(r->dir) == NULL) {
+    perror("mkdtemp");
+    exit(1);
+  }
+  for (i = 0; i < sizeof(helpers) / sizeof(helpers[0]); i++) {
+    absolute(from, helpers[i]);
+    snprintf(to, sizeof(to), "%s/%s", r->dir, helpers[i]);
+    if (symlink(from, to) < 0)
+      perror(to);
+  }
+  absolute(trace, r->trace);
+  r->start = now();
+  if ((r->pid = fork()) < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (r->pid == 0) {
+    snprintf(to, sizeof(to), "%s/output", r->dir);
+    if (chdir(r->dir) < 0 ||
+        (fd = open(to, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+      perror(r->dir);
+      _exit(1);
+    }
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    execl(driver, "tdriver", "-t", trace, "-s", shell, "-a", "-p",
+        (char *)NULL);
+    perror(driver);
+    _exit(127);
+  }
+}
+
+/*
+ * finishrun - compare what a trace printed with its .out file, or
+ *    write that file under -u, and report. Returns 1 if it failed. A
+ *    failed run's directory is kept for a look.
+ */
+static int finishrun(struct run *r)
+{
+  char expect[PATH_MAX], got[128], cmd[2 * PATH_MAX + 160];
+  size_t len = strlen(r->trace);
+  FILE *fp;
+  int failed = 0;
+
+  if (len > 4 && strcmp(r->trace + len - 4, ".txt") == 0)
+    len -= 4;
+  snprintf(expect, sizeof(expect), "%.*s.out", (int)len, r->trace);
+  snprintf(got, sizeof(got), "%s/masked", r->dir);
+  snprintf(cmd, sizeof(cmd), "%s/output", r->dir);
+
+  if (!WIFEXITED(r->status) || WEXITSTATUS(r->status) != 0) {
+    out("tcheck: %s: FAIL (%lld ms), driver exit status %d\n", r->trace,
+        r->ms, WIFEXITED(r->status) ? WEXITSTATUS(r->status) : -1);
+    failed = 1;
+  } else if (update) {
+    if (mask(cmd, expect) < 0) {
+      perror(expect);
+      failed = 1;
+    } else
+      out("tcheck: %s: wrote %s (%lld ms)\n", r->trace, expect, r->ms);
+  } else if (mask(cmd, got) < 0) {
+    perror(got);
+    failed = 1;
+  } else {
+    snprintf(cmd, sizeof(cmd), "diff -u '%s' '%s/masked'", expect, r->dir);
+    if ((fp = popen(cmd, "r")) == NULL) {
+      perror("popen");
+      exit(1);
+    }
+    failed = fread(cmd, 1, 1, fp) > 0;
+    out("tcheck: %s: %s (%lld ms)\n", r->trace, failed ? "FAIL" : "pass",
+        r->ms);
+    if (failed) {
+      out("%c", cmd[0]);
+      while (fgets(cmd, sizeof(cmd), fp) != NULL)
+        out("%s", cmd);
+      out("tcheck: %s: output kept in %s\n", r->trace, r->dir);
+    }
+    pclose(fp);
+  }
+  if (!failed)
+    cleanup(r->dir);
+  return failed;
+}
+
+/*
+ * mask - copy the file from to the file to, without what changes from
+ *    run to run: pids become PID and ps rows are left out
+ */
+static int mask(const char *from, const char *to)
+{
+  FILE *in, *fp;
+  char *line = NULL, *p, *q;
+  size_t cap = 0;
+
+  if ((in = fopen(from, "r")) == NULL)
+    return -1;
+  if ((fp = fopen(to, "w")) == NULL) {
+    fclose(in);
+    return -1;
+  }
+  while (getline(&line, &cap, in) > 0) {
+    for (p = line; *p == ' '; p++)
+      ;
+    if (p > line && isdigit((unsigned char)*p))
+      continue;
+    for (p = line; *p; p++) {
+      for (q = p + 1; isdigit((unsigned char)*q); q++)
+        ;
+      if (*p == '(' && q > p + 1 && *q == ')') {
+        fputs("(PID)", fp);
+        p = q;
+      } else if (strncmp(p, "pid ", 4) == 0 && isdigit((unsigned char)p[4])) {
+        fputs("pid PID", fp);
+        for (p += 4; isdigit((unsigned char)p[1]); p++)
+          ;
+      } else
+        putc(*p, fp);
+    }
+  }
+  free(line);
+  fclose(in);
+  return fclose(fp);
+}
+
+/*
+ * soak - run ncmds lines through one shell, sampling it as it goes.
+ *    Returns 1 if it leaked fds or more than slack KiB of memory.
+ */
+static int soak(long ncmds, long slack)
+{
+  char dir[] = "/tmp/tcheck.XXXXXX", *cmds, *p;
+  int in[2], outp[2], fds, basefds = -1, failed = 0, n;
+  long i, b, rss, baserss = 0, maxrss = 0, every = ncmds / SAMPLES;
+  long long start = now(), t;
+  size_t cap = 0, len;
+  pid_t pid;
+
+  for (n = 0; n < sizeof(mix) / sizeof(mix[0]); n++)
+    cap += strlen(mix[n]) + 1;
+  if (mkdtemp(dir) == NULL || (cmds = malloc(cap * (every + 1))) == NULL) {
+    perror("soak");
+    exit(1);
+  }
+  if (pipe2(in, O_CLOEXEC) < 0 || pipe2(outp, O_CLOEXEC) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  if ((pid = fork()) < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(outp[1], STDOUT_FILENO);
+    dup2(outp[1], STDERR_FILENO);
+    if (chdir(dir) < 0)
+      _exit(1);
+    signal(SIGPIPE, SIG_DFL);
+    execl(shell, shell, "-p", (char *)NULL);
+    perror(shell);
+    _exit(127);
+  }
+  close(in[0]);
+  close(outp[1]);
+  fcntl(in[1], F_SETFL, O_NONBLOCK);
+
+  out("tcheck: soak: %ld commands through %s, sampled every %ld\n",
+      ncmds, shell, every);
+  out("%10s %10s %6s %10s\n", "commands", "rss(KiB)", "fds", "ms");
+  for (i = 0; i < ncmds; ) {
+    for (p = cmds, b = 0; b < every && i < ncmds; b++, i++)
+      p += sprintf(p, "%s\n", mix[i % (sizeof(mix) / sizeof(mix[0]))]);
+    len = p - cmds;
+    t = now();
+    if (catchup(in[1], outp[0], cmds, len, i) < 0) {
+      out("tcheck: soak: FAIL, the shell went away after %ld commands\n", i);
+      failed = 1;
+      break;
+    }
+    sample(pid, &rss, &fds);
+    out("%10ld %10ld %6d %10lld\n", i, rss, fds, now() - t);
+    if (basefds < 0) {
+      /* the first batch warms up the arena, hash table and job list */
+      basefds = fds;
+      baserss = rss;
+    }
+    if (rss > maxrss)
+      maxrss = rss;
+    if (fds != basefds) {
+      out("tcheck: soak: FAIL, %d fds open, %d after the first batch\n",
+          fds, basefds);
+      failed = 1;
+    }
+  }
+  if (!failed && maxrss > baserss + slack) {
+    out("tcheck: soak: FAIL, rss grew from %ld to %ld KiB\n", baserss, maxrss);
+    failed = 1;
+  }
+  close(in[1]);
+  close(outp[0]);
+  waitpid(pid, NULL, 0);
+  out("tcheck: soak: %s, %ld commands, rss %ld..%ld KiB, %d fds, %lld ms\n",
+      failed ? "FAIL" : "pass", i, baserss, maxrss, basefds, now() - start);
+  free(cmds);
+  cleanup(dir);
+  return failed;
+}
+
+/*
+ * catchup - send the shell len bytes of commands, then a wait and a
+ *    marker, and read its output until the marker comes back, so every
+ *    job has been reaped. Returns -1 if the shell is gone.
+ */
+static int catchup(int tofd, int fromfd, char *cmds, size_t len, long mark)
+{
+  char buf[65536], want[64], tail[64];
+  struct pollfd pfd[2];
+  size_t sent = 0, tlen = 0, wlen;
+  ssize_t n;
+  char *p;
+
+  len += sprintf(cmds + len, "wait\necho tcheck %ld\n", mark);
+  wlen = snprintf(want, sizeof(want), "tcheck %ld\n", mark);
+  for (;;) {
+    pfd[0].fd = fromfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sent < len ? tofd : -1;
+    pfd[1].events = POLLOUT;
+    if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+      return -1;
+    if (pfd[1].revents & (POLLOUT | POLLERR)) {
+      if ((n = write(tofd, cmds + sent, len - sent)) < 0 && errno != EAGAIN)
+        return -1;
+      if (n > 0)
+        sent += n;
+    }
+    if (!(pfd[0].revents & (POLLIN | POLLHUP)))
+      continue;
+    if ((n = read(fromfd, buf, sizeof(buf))) <= 0)
+      return -1;
+    /* the marker may straddle two reads; keep the last line's start */
+    for (p = buf; p < buf + n; p++) {
+      if (tlen < sizeof(tail))
+        tail[tlen++] = *p;
+      if (*p == '\n') {
+        if (tlen == wlen && memcmp(tail, want, wlen) == 0 && sent == len)
+          return 0;
+        tlen = 0;
+      }
+    }
+  }
+}
+
+/* sample - the resident set of pid in KiB, and how many fds it has open */
+static void sample(pid_t pid, long *rss, int *fds)
+{
+  char path[64], line[256];
+  struct dirent *de;
+  FILE *fp;
+  DIR *dir;
+
+  *rss = -1;
+  *fds = 0;
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  if ((fp = fopen(path, "r")) != NULL) {
+    while (fgets(line, sizeof(line), fp) != NULL)
+      if (sscanf(line, "VmRSS: %ld", rss) == 1)
+        break;
+    fclose(fp);
+  }
+  snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+  if ((dir = opendir(path)) != NULL) {
+    while ((de = readdir(dir)) != NULL)
+      if (de->d_name[0] != '.')
+        (*fds)++;
+    closedir(dir);
+  }
+}
+
+/* cleanup - remove a temporary directory and the files in it */
+static void cleanup(const char *dir)
+{
+  char path[PATH_MAX];
+  struct dirent *de;
+  DIR *d;
+
+  if ((d = opendir(dir)) == NULL)
+    return;
+  while ((de = readdir(d)) != NULL) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    unlink(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+/* absolute - path is name relative to where we started */
+static void absolute(char *path, const char *name)
+{
+  char cwd[PATH_MAX], tmp[PATH_MAX];
+
+  while (strncmp(name, "./", 2) == 0)
+    name += 2;
+  if (name[0] == '/') {
+    snprintf(tmp, sizeof(tmp), "%s", name);
+  } else {
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+      perror("getcwd");
+      exit(1);
+    }
+    snprintf(tmp, sizeof(tmp), "%.*s/%s", PATH_MAX / 2, cwd, name);
+  }
+  memcpy(path, tmp, PATH_MAX);
+}
+
+/* out - print to stdout and to the report */
+static void out(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  if (report) {
+    va_start(ap, fmt);
+    vfprintf(report, fmt, ap);
+    va_end(ap);
+  }
+  fflush(stdout);
+}
+
+/* now - the monotonic clock, in ms */
+static long long now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/*
+ * usage - print a help message and terminate
+ */
+static void usage(void)
+{
+  fprintf(stderr, "Usage: tcheck [-u] [-j jobs] [-s shell] [-d driver] [-o report] trace...\n");
+  fprintf(stderr, "       tcheck -S [-n commands] [-r KiB] [-s shell] [-o report]\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -h            Print this message\n");
+  fprintf(stderr, "  -u            Write each trace's .out file instead of checking it\n");
+  fprintf(stderr, "  -j <jobs>     Traces run at once (default: online CPUs)\n");
+  fprintf(stderr, "  -s <shell>    Shell program to test (default ./tsh)\n");
+  fprintf(stderr, "  -d <driver>   Trace driver (default ./tdriver)\n");
+  fprintf(stderr, "  -o <report>   Write the report here as well\n");
+  fprintf(stderr, "  -S            Soak the shell instead\n");
+  fprintf(stderr, "  -n <count>    Command lines to soak it with (default 1000000)\n");
+  fprintf(stderr, "  -r <KiB>      Resident set growth allowed (default 512)\n");
+  exit(1);
+}
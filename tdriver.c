@@ -0,0 +1,515 @@
+/*
+ * tdriver.c - Event-driven shell driver
+ *
+ * usage: tdriver [-hvgl] [-T secs] -t <trace> -s <shell> [-a <args>]
+ *
+ * Runs a shell as a child and drives it from a trace file in the format
+ * sdriver.pl reads, printing the comment lines and then everything the
+ * shell wrote to stdout. Where sdriver.pl sleeps a fixed time before it
+ * sends a signal, tdriver waits for the state the sleep stood in for and
+ * sends the signal as soon as it holds.
+ *
+ * Driver commands:
+ *     TSTP, INT, QUIT, KILL   Send that signal to the shell
+ *     CLOSE                   Close the shell's stdin (EOF)
+ *     WAIT                    Wait for the shell to terminate
+ *     SLEEP <n>               Same as WAITFOR idle; with -l, sleep <n> secs
+ *     WAITFOR idle            Wait until the shell has taken all its input,
+ *                             and it and every process under it is asleep
+ *                             or stopped
+ *     WAITFOR output <re>     Wait for an output line, after the last one
+ *                             matched, to match the extended regex <re>
+ *     WAITFOR state <name> <states>
+ *                             Wait for a process under the shell with
+ *                             command name <name> to be in one of <states>,
+ *                             letters as in /proc/PID/stat (T is stopped)
+ *
+ * A WAITFOR that does not hold within the timeout (-T, 10 seconds by
+ * default) is reported on stderr, and tdriver goes on but exits with 1.
+ * Since sdriver.pl matches driver commands anywhere in a line, traces
+ * that use WAITFOR are for tdriver only.
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/pidfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXARGS     64
+
+struct pstat {              /* A process, from /proc/PID/stat */
+  pid_t pid;
+  pid_t ppid;
+  char state;
+  char comm[16];
+  int under;                /* the shell or a descendant of it */
+  unsigned long long runs;  /* times it was scheduled, if under */
+};
+
+/* Global variables */
+static pid_t shellpid;      /* the shell being driven */
+static int tofd = -1;       /* its stdin, -1 once closed */
+static int fromfd = -1;     /* its stdout, -1 at EOF */
+static int pidfd = -1;      /* readable once it exits, -1 once reaped */
+static char *out;           /* everything it wrote so far */
+static size_t outlen, outcap;
+static size_t scanned;      /* WAITFOR output looks at lines from here on */
+static int verbose;
+static long long timeout = 10000;   /* ms */
+
+static struct pstat *procs; /* the last scan of /proc */
+static int nprocs, proccap;
+
+/* Function prototypes */
+static void usage(const char *msg);
+static long long now(void);
+static int drain(int ms);
+static void reapshell(void);
+static int scanprocs(void);
+static int idle(void *arg);
+static int outputmatch(void *arg);
+static int instate(void *arg);
+static int waitfor(int (*cond)(void *), void *arg);
+static int directive(char *line);
+static void startshell(const char *shell, char *args);
+
+/*
+ * main - run the trace
+ */
+int main(int argc, char **argv)
+{
+  char *trace = NULL, *shell = NULL, *args = "";
+  int c, grade = 0, literal = 0, failed = 0;
+  char *line = NULL, save;
+  size_t cap = 0;
+  ssize_t n, len;
+  FILE *fp;
+
+  while ((c = getopt(argc, argv, "hvglT:t:s:a:")) != EOF) {
+    switch (c) {
+      case 'v': verbose = 1; break;
+      case 'g': grade = 1; break;
+      case 'l': literal = 1; break;
+      case 'T': timeout = atof(optarg) * 1000; break;
+      case 't': trace = optarg; break;
+      case 's': shell = optarg; break;
+      case 'a': args = optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (trace == NULL)
+    usage("Missing required -t argument");
+  if (shell == NULL)
+    usage("Missing required -s argument");
+  if ((fp = fopen(trace, "r")) == NULL) {
+    fprintf(stderr, "%s: ERROR: Couldn't open input file %s: %s\n",
+        argv[0], trace, strerror(errno));
+    exit(1);
+  }
+  if (access(shell, X_OK) < 0) {
+    fprintf(stderr, "%s: ERROR: %s is not executable\n", argv[0], shell);
+    exit(1);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  startshell(shell, args);
+  if (grade)
+    printf("pid=%d\n", shellpid);
+
+  while ((n = getline(&line, &cap, fp)) > 0) {
+    if (line[n-1] == '\n')
+      line[--n] = '\0';
+    if (line[0] == '#') {
+      printf("%s\n", line);
+      continue;
+    }
+    /* commands are sent as they are, but directives may trail blanks */
+    for (len = n; len > 0 && isspace((unsigned char)line[len-1]); len--)
+      ;
+    if (len == 0)
+      continue;
+    save = line[len];
+    line[len] = '\0';
+    if (literal && strncmp(line, "SLEEP ", 6) == 0) {
+      if (verbose)
+        printf("%s: Sleeping %s secs\n", argv[0], line + 6);
+      sleep(atoi(line + 6));
+      continue;
+    }
+    switch (directive(line)) {
+      case 1:
+        break;
+      case -1:
+        fprintf(stderr, "%s: %s: timed out after %lld ms\n", argv[0], line,
+            timeout);
+        failed = 1;
+        break;
+      default:
+        line[len] = save;
+        if (verbose)
+          printf("%s: Sending :%s: to child %d\n", argv[0], line, shellpid);
+        line[n] = '\n';
+        if (tofd >= 0 && write(tofd, line, n + 1) < 0 && errno != EPIPE)
+          perror("write");
+    }
+  }
+  free(line);
+  fclose(fp);
+
+  if (tofd >= 0)
+    close(tofd);
+  reapshell();
+  fflush(stdout);
+  if (fwrite(out, 1, outlen, stdout) != outlen)
+    perror("fwrite");
+  return failed;
+}
+
+/*
+ * directive - carry out line if it is a driver command. Returns 0 if it
+ *    is not one, -1 if it is a WAITFOR that timed out, 1 otherwise.
+ */
+static int directive(char *line)
+{
+  static const struct { const char *name; int sig; } sigs[] = {
+    { "TSTP", SIGTSTP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+    { "KILL", SIGKILL },
+  };
+  char *word, *name, *states;
+  unsigned long long snap = 0;
+  regex_t re;
+  int i, err;
+
+  for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+    if (strcmp(line, sigs[i].name) == 0) {
+      if (verbose)
+        printf("tdriver: Sending SIG%s signal to process %d\n", line, shellpid);
+      kill(shellpid, sigs[i].sig);
+      return 1;
+    }
+  if (strcmp(line, "CLOSE") == 0) {
+    if (tofd >= 0)
+      close(tofd);
+    tofd = -1;
+    return 1;
+  }
+  if (strcmp(line, "WAIT") == 0) {
+    reapshell();
+    return 1;
+  }
+  if (strncmp(line, "SLEEP ", 6) == 0 || strcmp(line, "WAITFOR idle") == 0)
+    return waitfor(idle, &snap);
+  if (strncmp(line, "WAITFOR output ", 15) == 0) {
+    if ((err = regcomp(&re, line + 15, REG_EXTENDED | REG_NOSUB)) != 0) {
+      fprintf(stderr, "tdriver: %s: bad regular expression\n", line);
+      return -1;
+    }
+    err = waitfor(outputmatch, &re);
+    regfree(&re);
+    return err;
+  }
+  if (strncmp(line, "WAITFOR state ", 14) == 0) {
+    word = line + 14;
+    name = strsep(&word, " ");
+    states = word;
+    if (states == NULL || *name == '\0' || *states == '\0') {
+      fprintf(stderr, "tdriver: %s: expected WAITFOR state <name> <states>\n",
+          line);
+      return -1;
+    }
+    err = waitfor(instate, (char *[]){ name, states });
+    states[-1] = ' ';
+    return err;
+  }
+  return 0;
+}
+
+/*
+ * waitfor - wait until cond(arg) holds, checking every millisecond and
+ *    reading the shell's output meanwhile. Returns 1, or -1 on timeout
+ *    or if the shell is gone first.
+ */
+static int waitfor(int (*cond)(void *), void *arg)
+{
+  long long deadline = now() + timeout;
+  struct pollfd exited = { .fd = pidfd, .events = POLLIN };
+
+  for (;;) {
+    drain(0);
+    if (cond(arg))
+      return 1;
+    if (pidfd < 0 || poll(&exited, 1, 0) > 0 || now() >= deadline)
+      return -1;
+    drain(1);
+  }
+}
+
+/*
+ * idle - the shell has read everything sent to it, and it and all of
+ *    its descendants are sleeping or stopped. arg is where the last
+ *    sample is kept: a sample only counts if the same processes have
+ *    not run since, so a spawn between two samples is never missed.
+ */
+static int idle(void *arg)
+{
+  unsigned long long *last = arg, snap = 14695981039346656037ULL;
+  int i, pending = 0;
+
+  if (tofd >= 0 && ioctl(tofd, FIONREAD, &pending) == 0 && pending > 0)
+    return 0;
+  if (scanprocs() == 0)
+    return 0;
+  for (i = 0; i < nprocs; i++) {
+    if (!procs[i].under)
+      continue;
+    if (!strchr("STt", procs[i].state))
+      return 0;
+    snap = (snap ^ procs[i].pid) * 1099511628211ULL;
+    snap = (snap ^ procs[i].runs) * 1099511628211ULL;
+  }
+  if (snap == *last)
+    return 1;
+  *last = snap;
+  return 0;
+}
+
+/* outputmatch - a new line of output matches the regex arg */
+static int outputmatch(void *arg)
+{
+  char *nl;
+  int hit;
+
+  while ((nl = memchr(out + scanned, '\n', outlen - scanned)) != NULL) {
+    *nl = '\0';
+    hit = regexec(arg, out + scanned, 0, NULL, 0) == 0;
+    *nl = '\n';
+    scanned = nl - out + 1;
+    if (hit)
+      return 1;
+  }
+  return 0;
+}
+
+/* instate - a descendant of the shell named arg[0] is in a state in arg[1] */
+static int instate(void *arg)
+{
+  char **want = arg;
+  int i;
+
+  scanprocs();
+  for (i = 0; i < nprocs; i++)
+    if (procs[i].under && procs[i].pid != shellpid &&
+        strcmp(procs[i].comm, want[0]) == 0 &&
+        strchr(want[1], procs[i].state))
+      return 1;
+  return 0;
+}
+
+/*
+ * scanprocs - read every process from /proc and mark the shell and its
+ *    descendants. Returns how many are marked.
+ */
+static int scanprocs(void)
+{
+  char path[64], buf[512], *p;
+  struct pstat *ps;
+  struct dirent *de;
+  int i, fd, len, changed, count = 0;
+  DIR *dir;
+
+  nprocs = 0;
+  if ((dir = opendir("/proc")) == NULL)
+    return 0;
+  while ((de = readdir(dir)) != NULL) {
+    if (!isdigit((unsigned char)de->d_name[0]))
+      continue;
+    snprintf(path, sizeof(path), "/proc/%.32s/stat", de->d_name);
+    if ((fd = open(path, O_RDONLY)) < 0)
+      continue;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    /* the name is in parentheses and may itself hold any character */
+    if (len <= 0 || (p = memrchr(buf, ')', len)) == NULL)
+      continue;
+    buf[len] = '\0';
+    if (nprocs == proccap) {
+      proccap = proccap ? 2 * proccap : 256;
+      if ((procs = realloc(procs, proccap * sizeof(*procs))) == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    ps = &procs[nprocs];
+    if (sscanf(p + 1, " %c %d", &ps->state, &ps->ppid) != 2)
+      continue;
+    ps->pid = atoi(buf);
+    *p = '\0';
+    snprintf(ps->comm, sizeof(ps->comm), "%s", strchr(buf, '(') + 1);
+    ps->under = ps->pid == shellpid;
+    count += ps->under;
+    nprocs++;
+  }
+  closedir(dir);
+
+  do {
+    changed = 0;
+    for (i = 0; i < nprocs; i++) {
+      if (procs[i].under)
+        continue;
+      for (ps = procs; ps < procs + nprocs; ps++)
+        if (ps->under && ps->pid == procs[i].ppid)
+          break;
+      if (ps < procs + nprocs) {
+        procs[i].under = changed = 1;
+        count++;
+      }
+    }
+  } while (changed);
+
+  for (ps = procs; ps < procs + nprocs; ps++) {
+    ps->runs = 0;
+    if (!ps->under)
+      continue;
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", ps->pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+      continue;
+    if ((len = read(fd, buf, sizeof(buf) - 1)) > 0) {
+      buf[len] = '\0';
+      sscanf(buf, "%*u %*u %llu", &ps->runs);
+    }
+    close(fd);
+  }
+  return count;
+}
+
+/*
+ * drain - read what the shell has written, waiting up to ms for it or
+ *    for the shell to exit (forever if ms < 0). Returns the bytes read.
+ */
+static int drain(int ms)
+{
+  struct pollfd pfd[2] = {
+    { .fd = fromfd, .events = POLLIN }, { .fd = pidfd, .events = POLLIN }
+  };
+  ssize_t n;
+
+  if (poll(pfd, 2, ms) <= 0 || !(pfd[0].revents & (POLLIN | POLLHUP)))
+    return 0;
+  if (outcap - outlen < 4096) {
+    outcap = outcap ? 2 * outcap : 65536;
+    if ((out = realloc(out, outcap)) == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  if ((n = read(fromfd, out + outlen, outcap - outlen)) > 0) {
+    outlen += n;
+    return n;
+  }
+  if (n == 0 || errno != EINTR) {
+    close(fromfd);
+    fromfd = -1;
+  }
+  return 0;
+}
+
+/*
+ * reapshell - wait for the shell to terminate, reading its output
+ *    meanwhile. Background jobs it leaves behind can hold its stdout
+ *    open for a long time, so the output is what was written by the
+ *    time it exits, not everything up to EOF.
+ */
+static void reapshell(void)
+{
+  while (pidfd >= 0) {
+    drain(-1);
+    if (waitpid(shellpid, NULL, WNOHANG) == shellpid) {
+      close(pidfd);
+      pidfd = -1;
+    }
+  }
+  while (fromfd >= 0 && drain(0) > 0)
+    ;
+}
+
+/*
+ * startshell - run shell with the words of args, connected to us by a
+ *    pipe each way
+ */
+static void startshell(const char *shell, char *args)
+{
+  char *argv[MAXARGS], *word;
+  int in[2], outp[2], argc = 0;
+
+  argv[argc++] = (char *)shell;
+  while ((word = strsep(&args, " \t")) != NULL && argc < MAXARGS - 1)
+    if (*word != '\0')
+      argv[argc++] = word;
+  argv[argc] = NULL;
+
+  if (pipe2(in, O_CLOEXEC) < 0 || pipe2(outp, O_CLOEXEC) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  if ((shellpid = fork()) < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (shellpid == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(outp[1], STDOUT_FILENO);
+    signal(SIGPIPE, SIG_DFL);
+    execv(shell, argv);
+    perror(shell);
+    _exit(127);
+  }
+  if ((pidfd = pidfd_open(shellpid, 0)) < 0) {
+    perror("pidfd_open");
+    exit(1);
+  }
+  close(in[0]);
+  close(outp[1]);
+  tofd = in[1];
+  fromfd = outp[0];
+}
+
+/* now - the monotonic clock, in ms */
+static long long now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/*
+ * usage - print a help message and terminate
+ */
+static void usage(const char *msg)
+{
+  if (msg)
+    fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "Usage: tdriver [-hvgl] [-T secs] -t <trace> -s <shell> -a <args>\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -h            Print this message\n");
+  fprintf(stderr, "  -v            Be more verbose\n");
+  fprintf(stderr, "  -t <trace>    Trace file\n");
+  fprintf(stderr, "  -s <shell>    Shell program to test\n");
+  fprintf(stderr, "  -a <args>     Shell arguments\n");
+  fprintf(stderr, "  -g            Generate output for autograder\n");
+  fprintf(stderr, "  -l            Sleep on SLEEP, as sdriver.pl does\n");
+  fprintf(stderr, "  -T <secs>     How long a WAITFOR may take (default 10)\n");
+  exit(1);
+}
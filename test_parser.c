@@ -1,21 +1,73 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "parser.h"
 
+#define MAXLINES 100000
+
+/*
+ * bench - tokenize and parse the lines on stdin over and over for
+ *   about a second and report throughput and allocations per line
+ */
+static int bench(void)
+{
+  static char *lines[MAXLINES];
+  char buf[1024];
+  char **v;
+  struct arena a;
+  struct timespec t0, t1;
+  long n = 0, rounds = 0, i;
+  double secs;
+
+  while (n < MAXLINES && fgets(buf, sizeof(buf), stdin) != NULL)
+    lines[n++] = strdup(buf);
+  if (n == 0)
+    return 1;
+
+  arena_init(&a);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  do {
+    for (i = 0; i < n; i++) {
+      if ((v = get_tokens(&a, lines[i])) != NULL)
+        parsecmd(&a, v);
+      arena_reset(&a);
+    }
+    rounds++;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  } while (secs < 1.0);
+
+  printf("%ld lines x %ld rounds: %.0f lines/s, %.6f allocations/line\n",
+      n, rounds, n * rounds / secs, (double)a.nalloc / (n * rounds));
+  arena_free(&a);
+  return 0;
+}
+
 int main(int argc, const char *argv[])
 {
-  char buf[100];
-  char *v[100];
+  char buf[1024];
+  char **v;
+  struct arena a;
   struct cmd* cmd;
+
+  if (argc > 1 && strcmp(argv[1], "-b") == 0)
+    return bench();
+
+  arena_init(&a);
   while(fgets(buf, sizeof(buf), stdin) != NULL) {
-    get_tokens(buf, v); 
-    token_dump(v);
-    printf("background %d\n", is_background(v));
-    cmd = parsecmd(v);
-
-    printf("===== dump =====\n");
-    cmd_dump(cmd);
-    printf("\n======\n");
-    token_clear(v);
+    v = get_tokens(&a, buf); 
+    if (v != NULL) {
+      token_dump(v);
+      printf("background %d\n", is_background(v));
+      cmd = parsecmd(&a, v);
+
+      printf("===== dump =====\n");
+      cmd_dump(cmd);
+      printf("\n======\n");
+    }
+    arena_reset(&a);
   }
+  arena_free(&a);
   return 0;
 }
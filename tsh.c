@@ -3,6 +3,7 @@
  * 
  * < bohao >
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -12,22 +13,29 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 #include <errno.h>
+#include <spawn.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/pidfd.h>
 #include "parser.h"
+#include "jobs.h"
+#include "hash.h"
+#include "reader.h"
+#include "builtins.h"
+#include "xargs.h"
+#include "vars.h"
+#include "expand.h"
+#include "events.h"
+#include "stats.h"
+#include "evtrace.h"
 
 /* Misc manifest constants */
-#define MAXLINE    1024   /* max line size */
-#define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
-#define MAXJID    1<<16   /* max job ID */
 #define MAXPATH    1024   /* max path length */
 #define SHOW_LEN     50   /* max show length of var length */
-
-/* Job states */
-#define UNDEF 0 /* undefined */
-#define FG 1    /* running in foreground */
-#define BG 2    /* running in background */
-#define ST 3    /* stopped */
+#define OUTBUF    65536   /* stdout buffer when it is not a terminal */
 
 /* 
  * Jobs states: FG (foreground), BG (background), ST (stopped)
@@ -43,16 +51,31 @@
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
-int nextjid = 1;            /* next job ID to allocate */
-char sbuf[MAXLINE];         /* for composing sprintf messages */
-
-struct job_t {              /* The job struct */
-    pid_t pid;              /* job PID */
-    int jid;                /* job ID [1, 2, ...] */
-    int state;              /* UNDEF, BG, FG, or ST */
-    char cmdline[MAXLINE];  /* command line */
-};
-struct job_t jobs[MAXJOBS]; /* The job list */
+int pipefail = 0;           /* set -o pipefail: a pipeline fails if any stage does */
+int pipesize = 0;           /* set -o pipesize=N: capacity of new pipes, 0 = default */
+int last_status = 0;        /* exit status of the last foreground job */
+int waitjid = 0;            /* job the wait builtin waits for, -1 any, 0 none */
+int waitstatus;             /* its status once done, -1 if interrupted */
+long long waited;           /* ns spent in waitfg and waitjob, not PH_BUILTIN's */
+struct usage fgusage;       /* what foreground jobs used, for the time builtin */
+pid_t shellpid;             /* forked children mustn't dump the stats */
+struct arena line_arena;    /* tokens and tree of the line being run */
+char **posv;                /* positional parameters, posv[0] is $0 */
+int posc;                   /* number of them, including $0 */
+sigset_t jobsigs;           /* SIGCHLD, SIGINT, SIGTSTP: taken from a signalfd */
+sigset_t childmask;         /* the signal mask children start with */
+int insubshell = 0;         /* this is a forked shell running a background list */
+pid_t jobpgid = 0;          /* process group new jobs join, 0 for their own */
+int interrupted;            /* ctrl-c reached the foreground: stop the list */
+struct reader *input;       /* where lines come from, and here-documents */
+struct procsub {            /* a <(cmd) or >(cmd) started for the next job */
+  pid_t pid;
+  int fd;                   /* the shell's end of its pipe, /dev/fd/fd */
+} *subs;
+int nsubs, subcap;
+pid_t subpgid;              /* their process group, 0 if there are none */
+
+struct joblist jobs;        /* The job list */
 /* End global variables */
 
 
@@ -60,59 +83,94 @@ struct job_t jobs[MAXJOBS]; /* The job list */
 
 /* Here are the functions that you will implement */
 void eval(char *cmdline);
+void heredocs(char **argv, char **cmdline);
+void runargv(char **argv, char *cmdline);
+void runlist(struct cmd *cmd);
+void runpipeline(struct cmd *command, int bg, char *cmdline);
+void subshell(struct cmd *cmd);
+char **expandargv(char **argv);
+int expandcmd(struct cmd *cmd);
+pid_t shellstart(const char *cmd, int len, int fd, int to, pid_t pgid);
+pid_t substart(const char *cmd, int len, int out);
+const char *procsub(int dir, const char *cmd, int len);
+void dropsubs(void);
+void subfinish(pid_t pid);
+int assignments(struct cmd *cmd);
+char *cmdtext(struct cmd *cmd, int bg);
+void puttext(FILE *f, struct cmd *cmd);
+void do_time(struct cmd *cmd);
+void do_stats(char **argv);
+void do_trace(char **argv);
+void dumpstats(void);
 int builtin_cmd(char **argv);
 int alias_cmd(char **argv);
 void do_bgfg(char **argv);
+void do_wait(char **argv);
+struct job_t *findjob(char *arg);
+int waitjob(int jid);
+void signaljob(struct job_t *job, int sig);
+void trackproc(struct proc_t *proc);
+void untrackproc(struct proc_t *proc);
 void waitfg(pid_t pid);
-void redirecting(char **argv);
 void do_pwd(char **argv);
 void do_cd(char **argv);
 void do_environ();
+void do_export(char **argv);
+void do_unset(char **argv);
+void do_hash(char **argv);
+void do_set(char **argv);
+void hashcmd(struct cmd *cmd);
 void runcmd(struct cmd *cmd);
-
-void sigchld_handler(int sig);
-void sigtstp_handler(int sig);
-void sigint_handler(int sig);
+int heretext(const char *text);
+int redirfd(struct redircmd *r);
+char *redirname(struct redircmd *r);
+builtin_t *cmdbuiltin(struct cmd *cmd);
+int runbuiltin(struct cmd *cmd, builtin_t *fn);
+void dropcloexec(void);
+void launch(struct cmd *cmd, sigset_t *mask, int bg, char *cmdline, int size);
+struct execcmd *xargscmd(struct cmd *cmd);
+void do_xargs(struct cmd *cmd, int bg, char *cmdline);
+int xargswait(int fd);
+pid_t startbatch(struct xargs *xa, int join, int *forked);
+void feedjob(struct job_t *job);
+int pipeprefix(struct cmd *cmd);
+long parsesize(const char *str);
+void readio(struct proc_t *proc);
+pid_t spawncmd(struct cmd *cmd, sigset_t *mask, pid_t pgid, int in, int out);
+pid_t forkcmd(struct cmd *cmd, sigset_t *mask, pid_t pgid, int in, int out);
+
+int handleevents(int input, int timeout);
+void waitinput(void);
+void reapchildren(void);
+void forwardsig(int sig);
 
 /* Here are helper routines that we've provided for you */
-int parse_line(const char *cmdline, char **argv); 
 void sigquit_handler(int sig);
 
-void clearjob(struct job_t *job);
-void initjobs(struct job_t *jobs);
-int maxjid(struct job_t *jobs); 
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *jobs, pid_t pid); 
-pid_t fgpid(struct job_t *jobs);
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
-struct job_t *getjobjid(struct job_t *jobs, int jid); 
-int pid2jid(pid_t pid); 
-void listjobs(struct job_t *jobs);
-
 void usage(void);
 void unix_error(char *msg);
 void app_error(char *msg);
 typedef void handler_t(int);
 handler_t *Signal(int signum, handler_t *handler);
 
-/* helper funcs */
-int find_arg(char** argv, char* str);
-
 /*
  * main - The shell's main routine 
  */
 int main(int argc, char **argv) 
 {
     char c;
-    char cmdline[MAXLINE];
+    char *cmdline;
+    char *command = NULL; /* -c command */
+    struct reader in;
+    int fd;
     int emit_prompt = 1; /* emit prompt (default) */
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     dup2(1, 2);
 
-    /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    /* Parse the command line; the first non-option is the script */
+    while ((c = getopt(argc, argv, "+hvpc:")) != EOF) {
       switch (c) {
         case 'h':             /* print help message */
           usage();
@@ -123,43 +181,93 @@ int main(int argc, char **argv)
         case 'p':             /* don't print a prompt */
           emit_prompt = 0;  /* handy for automatic testing */
           break;
+        case 'c':             /* run a command string */
+          command = optarg;
+          break;
         default:
           usage();
       }
     }
 
-    /* Install the signal handlers */
+    /* Pick the input: a -c string, a script file, or stdin */
+    posv = argv + optind;
+    posc = argc - optind;
+    if (command != NULL) {
+      reader_string(&in, command);
+      emit_prompt = 0;
+      if (posc == 0) {
+        posv = argv;
+        posc = 1;
+      }
+    } else if (posc > 0) {
+      if ((fd = open(posv[0], O_RDONLY | O_CLOEXEC)) < 0) {
+        printf("%s: %s\n", posv[0], strerror(errno));
+        exit(127);
+      }
+      reader_open(&in, fd);
+      emit_prompt = 0;
+    } else {
+      reader_open(&in, STDIN_FILENO);
+      posv = argv;
+      posc = 1;
+    }
 
-    /* These are the ones you will need to implement */
-    Signal(SIGINT,  sigint_handler);   /* ctrl-c */
-    Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-    Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+    /* Output is flushed when we block or start a child, not per line */
+    if (!isatty(STDOUT_FILENO))
+      setvbuf(stdout, NULL, _IOFBF, OUTBUF);
+
+    /*
+     * ctrl-c, ctrl-z and child state changes are not caught: they stay
+     * blocked and are read from a signalfd by the main loop, so jobs
+     * are only ever updated from ordinary code
+     */
+    sigemptyset(&jobsigs);
+    sigaddset(&jobsigs, SIGCHLD);
+    sigaddset(&jobsigs, SIGINT);
+    sigaddset(&jobsigs, SIGTSTP);
+    sigprocmask(SIG_BLOCK, NULL, &childmask);
+    if (events_init(&jobsigs) < 0)
+      unix_error("events_init error");
+    events_input(in.fd);
+    in.wait = waitinput;
+    input = &in;
 
     /* This one provides a clean way to kill the shell */
     Signal(SIGQUIT, sigquit_handler); 
 
+    /* -v or TSH_STATS=FILE: write the stats as JSON on exit */
+    shellpid = getpid();
+    if (verbose || getenv("TSH_STATS") != NULL)
+      atexit(dumpstats);
+
+    /* The environment becomes the shell's exported variables */
+    var_init(environ);
+
+    /*
+     * Watch PATH now, so the shells forked for $(cmd) share our inotify
+     * instance: one of their own would make each exit wait for RCU
+     */
+    hash_check();
+
     /* Initialize the job list */
-    initjobs(jobs);
+    initjobs(&jobs);
+    arena_init(&line_arena);
 
     /* Execute the shell's read/eval loop */
     while (1) {
 
-      /* Read command line */
-      if (emit_prompt) {
+      /* Read command line, reporting finished background jobs first */
+      if (jobs.njobs > 0)
+        handleevents(0, 0);
+      if (emit_prompt)
         printf("%s", prompt);
+      if ((cmdline = reader_line(&in)) == NULL) { /* End of file (ctrl-d) */
         fflush(stdout);
-      }
-      if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-        app_error("fgets error");
-      if (feof(stdin)) { /* End of file (ctrl-d) */
-        fflush(stdout);
-        exit(0);
+        exit(last_status);
       }
 
       /* Evaluate the command line */
       eval(cmdline);
-      fflush(stdout);
-      fflush(stdout);
     } 
 
     exit(0); /* control never reaches here */
@@ -178,194 +286,1263 @@ int main(int argc, char **argv)
 */
 void eval(char *cmdline) 
 {
-  char *argv[MAXARGS]; 
-  pid_t pid;
+  char **argv; 
+  long long t = stats_now();
+
+  argv = get_tokens(&line_arena, cmdline);
+  stats_time(PH_TOKENIZE, t);
+  stats_count(ST_LINES);
+  if (argv == NULL)
+    last_status = 2;    /* as for the errors parsecmd finds */
+  else
+    heredocs(argv, &cmdline);
+  if (argv != NULL && argv[0] != NULL)
+    runargv(argv, cmdline);
+  /* 
+   * free the tokens and the tree, builtin or not
+   */
+  dropsubs();
+  arena_reset(&line_arena);
+  return;
+}
+
+/*
+ * heredocs - read the text of each << here-document on the line from
+ *    the shell's input, up to the line that is just its delimiter, and
+ *    put it in the delimiter's place for parseredirs. If the delimiter
+ *    was quoted a TOK_LITERAL goes before each $, so nothing expands.
+ *    Reading on may move the buffer *cmdline is in, so the line is
+ *    copied into the arena first.
+ */
+void heredocs(char **argv, char **cmdline)
+{
+  char *line, *delim, *s, *w;
+  size_t n;
+  int i, literal, copied = 0;
+
+  for (i = 0; argv[i] != NULL; i++) {
+    if (!is_op(argv[i]) || strcmp(argv[i], "<<") != 0 ||
+        argv[i + 1] == NULL || is_op(argv[i + 1]))
+      continue;
+    if (!copied) {
+      *cmdline = strcpy(arena_alloc(&line_arena, strlen(*cmdline) + 1), *cmdline);
+      copied = 1;
+    }
+    delim = argv[++i];
+    literal = delim[0] == TOK_LITERAL;
+    delim += literal;
+    while (1) {
+      line = input != NULL ? reader_line(input) : NULL;
+      if (line == NULL) {
+        printf("here-document ended by end of input (wanted %s)\n", delim);
+        break;
+      }
+      n = strcspn(line, "\n");
+      if (strncmp(line, delim, n) == 0 && delim[n] == 0)
+        break;
+      /* room for the line, a marker per byte and the newline */
+      w = s = arena_room(&line_arena, 2 * n + 1);
+      for (; n > 0; n--, line++) {
+        if (literal && *line == '$')
+          *w++ = TOK_LITERAL;
+        *w++ = *line;
+      }
+      *w++ = '\n';
+      arena_grew(&line_arena, w - s);
+    }
+    arena_grow(&line_arena, 0);
+    argv[i] = arena_finish(&line_arena);
+  }
+}
+
+/*
+ * runargv - run the command in a tokenized line: a builtin, or a
+ *    pipeline that is launched as one job, or a list of those
+ */
+void runargv(char **argv, char *cmdline)
+{
   int bg;
   struct cmd *command;
-  sigset_t newMask, oldMask;
-  sigemptyset(&newMask);
-  sigaddset(&newMask, SIGCHLD);
-  sigaddset(&newMask, SIGINT);
-  sigaddset(&newMask, SIGTSTP);
+  long long t;
+
+  interrupted = 0;
+  if (is_list(argv)) {
+    t = stats_now();
+    command = parsecmd(&line_arena, argv);
+    stats_time(PH_PARSE, t);
+    if (command == NULL)
+      last_status = 2;
+    else
+      runlist(command);
+    return;
+  }
 
-  get_tokens(cmdline, argv);
-  bg = is_background(argv);
-  if (argv[0] == NULL) {
+  /* $? is still the last line's status here */
+  if ((argv = expandargv(argv)) == NULL) {
+    last_status = 1;
     return;
   }
+  /* builtins that fail say so */
+  last_status = 0;
+  bg = is_background(argv);
 
+  /* less the time fg and wait spend blocked, which is PH_WAIT's */
+  waited = 0;
+  t = stats_now();
+  if (builtin_cmd(argv)) {
+    stats_time(PH_BUILTIN, t + waited);
+    stats_count(ST_BUILTINS);
+    return;
+  }
   // not builtin in
-  if (builtin_cmd(argv) == 0 && alias_cmd(argv) == 0) {
-    /**
-     * block SIGCHLD, SIGINT, SIGTSTP
-     * to prevent race conditions of jobs. 
-     * for example: the sigchld handler triggered before addjobs.
+  if (alias_cmd(argv) == 0) {
+    /*
+     * parse in the shell, so a malformed line costs no fork and
+     * simple commands can be launched without one.
      */
-    sigprocmask(SIG_SETMASK, &newMask, &oldMask);
-    pid = fork();  
-    if (pid < 0) {
-      exit(-1);
+    t = stats_now();
+    command = parsecmd(&line_arena, argv);
+    stats_time(PH_PARSE, t);
+    if (command == NULL) {
+      last_status = 2;
+      return;
     }
-    if (pid > 0) {
+    if (command->type == '&')
+      command = ((struct listcmd *)command)->left;
+    runpipeline(command, bg, cmdline);
+  }
+}
 
-      if(bg == 0) {
-        addjob(&jobs[0], pid, FG, cmdline);
-        sigprocmask(SIG_SETMASK, &oldMask, NULL);
-        waitfg(pid);
-      } else {
-        printf("[%d] (%d) %s", nextjid, pid, cmdline);
-        addjob(&jobs[0], pid, BG, cmdline);
-        sigprocmask(SIG_SETMASK, &oldMask, NULL);
-      }
-      /* 
-       * free argv's dynamic allocated memory
-       */
-      token_clear(argv);
-    }
-    else {
-      setpgid(0, 0); // send SIGINT to the foreground job
-      sigprocmask(SIG_SETMASK, &oldMask, NULL);
-      //printf("ve:%s %s\n", argv[0], argv[1]);
-
-      command = parsecmd(argv);
-      runcmd(command);
-      
+/*
+ * runlist - run a line with ;, &&, || or a & before its end, in the
+ *    shell itself: each foreground pipeline is waited for before the
+ *    next is looked at, and && and || go by last_status, so a chain
+ *    of N commands costs N children and no extra shell. Only an and-or
+ *    list sent to the background needs a forked shell (see subshell).
+ *    ctrl-c stops the rest of the list.
+ */
+void runlist(struct cmd *cmd)
+{
+  struct listcmd *lcmd = (struct listcmd *)cmd;
+  struct cmd *c;
+  long long t;
+
+  switch (cmd->type) {
+    case ';':
+      runlist(lcmd->left);
+      if (!interrupted)
+        runlist(lcmd->right);
+      return;
+    case 'A':
+    case 'O':
+      runlist(lcmd->left);
+      if (!interrupted && (last_status == 0) == (cmd->type == 'A'))
+        runlist(lcmd->right);
+      return;
+    case 'T':
+      do_time(lcmd->left);
+      return;
+    case '&':
+      if (is_listcmd(lcmd->left))
+        launch(lcmd->left, &childmask, 1, cmdtext(lcmd->left, 1), pipesize);
+      else if (expandcmd(lcmd->left) == 0)
+        runpipeline(lcmd->left, 1, cmdtext(lcmd->left, 1));
+      dropsubs();
+      last_status = 0;
+      if (lcmd->right != NULL)
+        runlist(lcmd->right);
+      return;
+  }
+
+  if (expandcmd(cmd) < 0) {
+    dropsubs();
+    last_status = 1;
+    return;
+  }
+  /* the shell's own builtins, which ignore redirections as before */
+  for (c = cmd; c->type == '<' || c->type == '>'; c = ((struct redircmd *)c)->cmd)
+    ;
+  last_status = 0;
+  if (c->type == ' ' && ((struct execcmd *)c)->argv[0] != 0) {
+    waited = 0;
+    t = stats_now();
+    if (builtin_cmd(((struct execcmd *)c)->argv)) {
+      stats_time(PH_BUILTIN, t + waited);
+      stats_count(ST_BUILTINS);
+      dropsubs();
+      return;
     }
+    alias_cmd(((struct execcmd *)c)->argv);
   }
-  return;
+  runpipeline(cmd, 0, cmdtext(cmd, 0));
 }
 
-void runcmd(struct cmd *cmd) {
-  int p[2], r, pr;
+/*
+ * runpipeline - run one parsed pipeline: xargs, a builtin utility in
+ *    the shell, or a job
+ */
+void runpipeline(struct cmd *command, int bg, char *cmdline)
+{
+  builtin_t *fn;
+  int size, nvars;
+
+  size = pipeprefix(command);
+  if (size == -1)
+    return;
+  if ((nvars = assignments(command)) < 0) {
+    dropsubs();
+    return;
+  }
+  hash_check();
+  hashcmd(command);
+  /* xargs and parallel run their batches as the processes of one job */
+  if (xargscmd(command) != NULL)
+    do_xargs(command, bg, cmdline);
+  /* echo, test and friends run right here unless they need a child */
+  else if (!bg && (fn = cmdbuiltin(command)) != NULL)
+    last_status = runbuiltin(command, fn);
+  else
+    launch(command, &childmask, bg, cmdline, size ? size : pipesize);
+  var_pop(nvars);
+  dropsubs();
+}
+
+/* expandargv - expand the $ in a line's words, see expand.h */
+char **expandargv(char **argv)
+{
+  struct params p = { last_status, shellpid, posv, posc, substart, subfinish, procsub };
+
+  return expand_argv(&line_arena, argv, &p);
+}
+
+/*
+ * expandcmd - expand the $ in the words and file names of a pipeline
+ *    that is part of a list, just before it runs. -1 if one can't be.
+ */
+int expandcmd(struct cmd *cmd)
+{
   struct execcmd *ecmd;
-  struct pipecmd *pcmd;
   struct redircmd *rcmd;
+  struct params p = { last_status, shellpid, posv, posc, substart, subfinish, procsub };
+  char **argv;
+
+  switch (cmd->type) {
+    case ' ':
+      ecmd = (struct execcmd *)cmd;
+      if ((argv = expand_argv(&line_arena, ecmd->argv, &p)) == NULL)
+        return -1;
+      if (argv != ecmd->argv) {
+        ecmd->argv = argv;
+        for (ecmd->argc = 0; argv[ecmd->argc] != NULL; ecmd->argc++)
+          ;
+        ecmd->cap = ecmd->argc + 1;
+      }
+      return 0;
+    case '<':
+    case '>':
+      rcmd = (struct redircmd *)cmd;
+      if (rcmd->how != '&' &&
+          (rcmd->file = expand_word(&line_arena, rcmd->file, &p)) == NULL)
+        return -1;
+      return expandcmd(rcmd->cmd);
+    case '|':
+      if (expandcmd(((struct pipecmd *)cmd)->left) < 0)
+        return -1;
+      return expandcmd(((struct pipecmd *)cmd)->right);
+  }
+  return 0;
+}
 
-  if (cmd == 0) {
+/*
+ * shellstart - start cmd (len bytes) in a forked shell with fd as its
+ *    fd to; it runs like a background list, see subshell. The shell
+ *    joins process group pgid (0 makes a new one), or stays in ours
+ *    if pgid is -1.
+ */
+pid_t shellstart(const char *cmd, int len, int fd, int to, pid_t pgid)
+{
+  struct cmd *command;
+  char **argv, *line;
+  pid_t pid;
+
+  fflush(stdout);
+  if ((pid = fork()) < 0) {
+    printf("fork error: %s\n", strerror(errno));
+    return -1;
+  }
+  if (pid > 0) {
+    if (pgid >= 0)
+      setpgid(pid, pgid ? pgid : pid);
+    stats_count(ST_FORKS);
+    return pid;
+  }
+
+  /* in a job, it stops and dies with the job's other processes */
+  if (pgid >= 0) {
+    setpgid(0, pgid);
+    sigprocmask(SIG_SETMASK, &childmask, NULL);
+  }
+  if (fd != to) {
+    dup2(fd, to);
+    close(fd);
+  }
+  line = strndup(cmd, len);
+  arena_reset(&line_arena);
+  if ((argv = get_tokens(&line_arena, line)) == NULL)
+    exit(2);
+  if (argv[0] == NULL)
     exit(0);
+  /* the shell's input is not ours to read here-documents from */
+  input = NULL;
+  heredocs(argv, &line);
+  if ((command = parsecmd(&line_arena, argv)) == NULL)
+    exit(2);
+  subshell(command);
+  return -1;
+}
+
+/* substart - start $(cmd) (len bytes) with its stdout on out */
+pid_t substart(const char *cmd, int len, int out)
+{
+  return shellstart(cmd, len, out, STDOUT_FILENO, -1);
+}
+
+/* subfinish - reap the $(cmd) that substart started */
+void subfinish(pid_t pid)
+{
+  int status;
+
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+}
+
+/*
+ * procsub - start the cmd (len bytes) of <(cmd) (dir '<') or >(cmd) in
+ *    a forked shell on one end of a pipe, and return the /dev/fd path
+ *    of the other end. The shell keeps that end open, and not
+ *    close-on-exec, until the pipeline it is an argument of has
+ *    started. The helper goes in that pipeline's process group and
+ *    launch makes it a process of its job, so jobs, fg and ctrl-c
+ *    reach it too.
+ */
+const char *procsub(int dir, const char *cmd, int len)
+{
+  static char path[32];
+  int p[2], mine, theirs;
+  pid_t pid;
+
+  if (pipe2(p, O_CLOEXEC) < 0) {
+    printf("pipe error: %s\n", strerror(errno));
+    return NULL;
+  }
+  mine = dir == '<' ? p[0] : p[1];
+  theirs = dir == '<' ? p[1] : p[0];
+  if (nsubs == subcap) {
+    subcap = subcap ? subcap * 2 : 4;
+    subs = realloc(subs, subcap * sizeof(*subs));
+  }
+  /* listed first, so the helper closes our end in subshell */
+  subs[nsubs].pid = 0;
+  subs[nsubs++].fd = mine;
+  pid = shellstart(cmd, len, theirs, dir == '<' ? STDOUT_FILENO : STDIN_FILENO,
+                   jobpgid ? jobpgid : subpgid);
+  close(theirs);
+  if (pid < 0) {
+    close(subs[--nsubs].fd);
+    return NULL;
   }
+  subs[nsubs - 1].pid = pid;
+  if (jobpgid == 0 && subpgid == 0)
+    subpgid = pid;
+  fcntl(mine, F_SETFD, 0);
+  snprintf(path, sizeof(path), "/dev/fd/%d", mine);
+  return path;
+}
+
+/*
+ * dropsubs - close the shell's ends of the pipes to the <(cmd) and
+ *    >(cmd) helpers, once what they were for has started (or failed
+ *    to), and forget them
+ */
+void dropsubs(void)
+{
+  while (nsubs > 0)
+    close(subs[--nsubs].fd);
+  subpgid = 0;
+}
+
+/*
+ * subshell - run a background and-or list in this forked child, which
+ *    is already in the job's process group, or a $(cmd) in the shell's
+ *    group, then exit with its status.
+ *    It starts over with no jobs and events of its own, and its
+ *    pipelines join its group, so fg, bg, ctrl-c and ctrl-z reach
+ *    them along with it. Those signals aren't taken from the signalfd
+ *    here: ctrl-c ends the subshell too, and ctrl-z stops it, so it
+ *    doesn't look at its children stopping.
+ */
+void subshell(struct cmd *cmd)
+{
+  dropsubs();
+  insubshell = 1;
+  jobpgid = getpgrp();
+  freejobs(&jobs);
+  initjobs(&jobs);
+  sigemptyset(&jobsigs);
+  sigaddset(&jobsigs, SIGCHLD);
+  if (events_init(&jobsigs) < 0)
+    unix_error("events_init error");
+  events_input(-1);
+  runlist(cmd);
+  fflush(stdout);
+  exit(last_status);
+}
+
+/*
+ * cmdtext - the command line of a job that is only part of the line
+ *    typed: its words as parsed, then " &" for a background job and a
+ *    newline, like a whole line
+ */
+char *cmdtext(struct cmd *cmd, int bg)
+{
+  char *buf = NULL, *text;
+  size_t len = 0;
+  FILE *f;
+
+  if ((f = open_memstream(&buf, &len)) == NULL)
+    return bg ? "&\n" : "\n";
+  puttext(f, cmd);
+  fprintf(f, bg ? " &\n" : "\n");
+  fclose(f);
+  text = arena_alloc(&line_arena, len + 1);
+  memcpy(text, buf, len + 1);
+  free(buf);
+  return text;
+}
+
+/* puttext - write cmd out the way it could have been typed */
+void puttext(FILE *f, struct cmd *cmd)
+{
+  struct listcmd *lcmd;
+  struct redircmd *rcmd;
+  struct cmd *c;
+  char **argv;
 
   switch (cmd->type) {
-    default:
-      fprintf(stderr, "unknown runcmd\n");
-      exit(-1);
     case ' ':
-      ecmd = (struct execcmd *)cmd;
-      if(ecmd->argv[0] == 0) {
-        exit(0);
-      }
- 
-      //printf("d cmd:%s arg:%s\n", ecmd->argv[0], ecmd->argv[1]);
-      r = execvp(ecmd->argv[0], ecmd->argv);
-      //r = execve(ecmd->argv[0], ecmd->argv, environ);
-      if (r < 0) {
-        // filename not found
-        printf("command %s not found\n", ecmd->argv[0]);
-        exit(0);
-      }
+      for (argv = ((struct execcmd *)cmd)->argv; *argv != 0; argv++)
+        fprintf(f, argv[1] != 0 ? "%s " : "%s", *argv);
       break;
     case '<':
     case '>':
       rcmd = (struct redircmd *)cmd;
-      //printf("D %s mode=%d fd=%d\n", rcmd->file, rcmd->mode, rcmd->fd);
-      close(rcmd->fd);
-      open(rcmd->file, rcmd->mode,
-           S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-      runcmd(rcmd->cmd);
+      for (c = rcmd->cmd; c->type == '<' || c->type == '>'; c = ((struct redircmd *)c)->cmd)
+        ;
+      puttext(f, c);
+      /* outermost first, the order they were written in */
+      for (c = cmd; c->type == '<' || c->type == '>'; c = rcmd->cmd) {
+        rcmd = (struct redircmd *)c;
+        fprintf(f, " ");
+        if (rcmd->fd != (c->type == '<' ? 0 : 1) || rcmd->how == '&')
+          fprintf(f, "%d", rcmd->fd);
+        if (rcmd->how == '&')
+          fprintf(f, ">&%d", rcmd->dupfd);
+        else if (rcmd->how == 'h')
+          fprintf(f, "<<EOF");
+        else
+          fprintf(f, "%s %s", c->type == '<' ? "<" : rcmd->mode & O_APPEND ? ">>" : ">",
+                  rcmd->file);
+      }
       break;
-
     case '|':
-      pcmd = (struct pipecmd *)cmd;
-      r = pipe(p);
-      if (r == -1) {
-        fprintf(stderr, "pipe error\n"); 
-        exit(-1);
+      puttext(f, ((struct pipecmd *)cmd)->left);
+      fprintf(f, " | ");
+      puttext(f, ((struct pipecmd *)cmd)->right);
+      break;
+    case 'T':
+      fprintf(f, "time ");
+      puttext(f, ((struct listcmd *)cmd)->left);
+      break;
+    default:
+      lcmd = (struct listcmd *)cmd;
+      puttext(f, lcmd->left);
+      fprintf(f, cmd->type == 'A' ? " && " : cmd->type == 'O' ? " || " :
+                 cmd->type == ';' ? "; " : " & ");
+      if (lcmd->right != NULL)
+        puttext(f, lcmd->right);
+      break;
+  }
+}
+
+/*
+ * do_time - time pipeline, wherever parsepipe found it: run cmd, then
+ *    print the elapsed time, to the nanosecond clock_gettime gives, and the CPU
+ *    time, peak RSS and context switches of what ran: the processes of
+ *    the foreground job (from wait4) plus the shell itself, for
+ *    builtins.
+ */
+void do_time(struct cmd *cmd)
+{
+  struct timespec t0, t1;
+  struct rusage r0, r1;
+  struct usage u;
+  long long ns;
+
+  memset(&fgusage, 0, sizeof(fgusage));
+  getrusage(RUSAGE_SELF, &r0);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  runlist(cmd);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  getrusage(RUSAGE_SELF, &r1);
+
+  u = fgusage;
+  timersub(&r1.ru_utime, &r0.ru_utime, &r1.ru_utime);
+  timersub(&r1.ru_stime, &r0.ru_stime, &r1.ru_stime);
+  timeradd(&u.utime, &r1.ru_utime, &u.utime);
+  timeradd(&u.stime, &r1.ru_stime, &u.stime);
+  u.nvcsw += r1.ru_nvcsw - r0.ru_nvcsw;
+  u.nivcsw += r1.ru_nivcsw - r0.ru_nivcsw;
+
+  ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+  printf("real\t%lld.%09llds\n", ns / 1000000000, ns % 1000000000);
+  printf("user\t%ld.%06lds\n", (long)u.utime.tv_sec, (long)u.utime.tv_usec);
+  printf("sys\t%ld.%06lds\n", (long)u.stime.tv_sec, (long)u.stime.tv_usec);
+  printf("maxrss\t%ldK\n", u.maxrss);
+  printf("csw\t%ld+%ld\n", u.nvcsw, u.nivcsw);
+}
+
+/*
+ * launch - run a parsed pipeline as one job. All N-1 pipes are made up
+ *    front and every stage is started directly by the shell into one
+ *    process group, whose ID is the first stage's pid (or a background
+ *    list's subshell's, in one). The job is known by that pid. Stages are
+ *    spawned when they are simple commands and forked otherwise.
+ *    A stage that can't be started still gets an entry in the job,
+ *    with exit status 127. If size is not 0 the pipes are resized to
+ *    hold that many bytes, so long pipelines switch less often.
+ */
+void launch(struct cmd *cmd, sigset_t *mask, int bg, char *cmdline, int size)
+{
+  struct cmd **stages, *c;
+  struct job_t *job;
+  struct proc_t *proc;
+  pid_t *pids, pgid = jobpgid ? jobpgid : subpgid, leader = 0;
+  int p[2], in = -1, out, next_in;
+  int i, n;
+  long long *t0, *t1;         /* when starting each stage began and ended */
+  char *forked;
+
+  for (n = 1, c = cmd; c->type == '|'; c = ((struct pipecmd *)c)->right)
+    n++;
+  stages = arena_alloc(&line_arena, n * sizeof(*stages));
+  pids = arena_alloc(&line_arena, n * sizeof(*pids));
+  t0 = arena_alloc(&line_arena, n * sizeof(*t0));
+  t1 = arena_alloc(&line_arena, n * sizeof(*t1));
+  forked = arena_alloc(&line_arena, n);
+  for (i = 0, c = cmd; c->type == '|'; c = ((struct pipecmd *)c)->right)
+    stages[i++] = ((struct pipecmd *)c)->left;
+  stages[i] = c;
+
+  for (i = 0; i < n; i++) {
+    out = next_in = -1;
+    if (i < n - 1) {
+      if (pipe2(p, O_CLOEXEC) < 0) {
+        printf("pipe error: %s\n", strerror(errno));
+        for (; i < n; i++)
+          pids[i] = -1;
+        break;
+      }
+      next_in = p[0];
+      out = p[1];
+      if (size > 0 && fcntl(out, F_SETPIPE_SZ, size) < 0 && i == 0)
+        printf("pipesize %d: %s\n", size, strerror(errno));
+    }
+
+    t0[i] = stats_now();
+    forked[i] = 0;
+    pids[i] = spawncmd(stages[i], mask, pgid, in, out);
+    if (pids[i] > 0) {
+      t1[i] = stats_time(PH_SPAWN, t0[i]);
+      stats_count(ST_SPAWNS);
+    } else if (pids[i] == 0) {
+      t0[i] = stats_now();
+      forked[i] = 1;
+      pids[i] = forkcmd(stages[i], mask, pgid, in, out);
+      if (pids[i] > 0) {
+        t1[i] = stats_time(PH_FORK, t0[i]);
+        stats_count(ST_FORKS);
+      }
+    }
+    if (pids[i] > 0 && leader == 0) {
+      leader = pids[i];
+      if (pgid == 0)
+        pgid = leader;
+    }
+
+    if (in >= 0)
+      close(in);
+    if (out >= 0)
+      close(out);
+    in = next_in;
+  }
+  if (in >= 0)
+    close(in);
+
+  if (leader == 0) { /* nothing started */
+    last_status = 127;
+    return;
+  }
+
+  /* with <(cmd) or >(cmd) the first helper leads the process group */
+  job = addjob(&jobs, subpgid ? subpgid : leader, bg ? BG : FG, cmdline);
+  for (i = 0; i < n; i++) {
+    if (pids[i] > 0) {
+      trackproc(addproc(&jobs, job, pids[i]));
+      evtrace_at(t0[i], forked[i] ? TR_FORK : TR_SPAWN, pids[i], job->jid, 0);
+      if (!forked[i])
+        evtrace_at(t1[i], TR_EXEC, pids[i], job->jid, 0);
+    } else {
+      addproc(&jobs, job, 0);
+    }
+  }
+  for (i = 0; i < nsubs; i++) {
+    proc = addproc(&jobs, job, subs[i].pid);
+    proc->helper = 1;
+    trackproc(proc);
+    evtrace_add(TR_FORK, subs[i].pid, job->jid, 0);
+  }
+  /* a >(cmd) sees EOF only once its writers, us too, are gone */
+  dropsubs();
+  if (verbose) {
+    printf("Added job [%d] %d %s\n", job->jid, job->pid, job->cmdline);
+  }
+  if(bg == 0) {
+    waitfg(job->pid);
+  } else {
+    printf("[%d] (%d) %s", job->jid, job->pid, cmdline);
+  }
+}
+
+/*
+ * xargscmd - the command itself if cmd is xargs or parallel with only
+ *    redirections around it, otherwise NULL
+ */
+struct execcmd *xargscmd(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+
+  while (cmd->type == '<' || cmd->type == '>')
+    cmd = ((struct redircmd *)cmd)->cmd;
+  if (cmd->type != ' ')
+    return NULL;
+  ecmd = (struct execcmd *)cmd;
+  if (ecmd->argv[0] == 0 || (strcmp(ecmd->argv[0], "xargs") != 0 &&
+                              strcmp(ecmd->argv[0], "parallel") != 0))
+    return NULL;
+  return ecmd;
+}
+
+/*
+ * do_xargs - run xargs or parallel as one job whose processes are its
+ *    batches. The shell reads the words from the < file (or its own
+ *    stdin, starting with what the line reader has read of it already)
+ *    unless parallel was given them, and ctrl-c gives that read up. It
+ *    opens the > file once for every batch to share, and gives the
+ *    batches /dev/null as stdin. The first -P (-j) batches start here;
+ *    feedjob starts the others as those are reaped, foreground or
+ *    background.
+ */
+void do_xargs(struct cmd *cmd, int bg, char *cmdline)
+{
+  struct redircmd *rcmd;
+  struct xargs *xa;
+  struct job_t *job;
+  int in = STDIN_FILENO, out = -1, *fd, forked;
+  char *head = NULL;
+  size_t n = 0;
+  pid_t pid;
+
+  /* in the order runcmd applies them; only stdin and stdout can be */
+  for (; cmd->type == '<' || cmd->type == '>'; cmd = rcmd->cmd) {
+    rcmd = (struct redircmd *)cmd;
+    fd = rcmd->fd == 0 ? &in : &out;
+    if (*fd > STDIN_FILENO)
+      close(*fd);
+    if (rcmd->fd > 1 || rcmd->how == '&') {
+      printf("%s: only stdin and stdout can be redirected\n", xargscmd(cmd)->argv[0]);
+      *fd = -1;
+    } else if ((*fd = redirfd(rcmd)) < 0) {
+      printf("%s: %s\n", redirname(rcmd), strerror(errno));
+    }
+    if (*fd < 0) {
+      if (in > STDIN_FILENO)
+        close(in);
+      if (out >= 0)
+        close(out);
+      last_status = 1;
+      return;
+    }
+  }
+
+  last_status = 1;
+  if ((xa = xargs_new(((struct execcmd *)cmd)->argv)) == NULL) {
+    if (in > STDIN_FILENO)
+      close(in);
+    if (out >= 0)
+      close(out);
+    return;
+  }
+  xa->out = out;
+  xa->wait = xargswait;
+  /* lines of the shell's own stdin that the reader has read already */
+  if (xa->items == NULL && in == STDIN_FILENO && input != NULL &&
+      input->fd == STDIN_FILENO)
+    head = reader_rest(input, &n);
+  if (xargs_read(xa, in, head, n) < 0) {
+    if (in > STDIN_FILENO)
+      close(in);
+    if (interrupted)
+      last_status = 128 + SIGINT;
+    xargs_free(xa);
+    return;
+  }
+  if (in > STDIN_FILENO)
+    close(in);
+  xa->in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+  if ((pid = startbatch(xa, 0, &forked)) <= 0) {
+    last_status = xa->status;
+    xargs_free(xa);
+    return;
+  }
+  job = addjob(&jobs, pid, bg ? BG : FG, cmdline);
+  job->xargs = xa;
+  trackproc(addproc(&jobs, job, pid));
+  evtrace_add(forked ? TR_FORK : TR_SPAWN, pid, job->jid, 0);
+  feedjob(job);
+  dropsubs();
+  if (verbose)
+    printf("Added job [%d] %d %s\n", job->jid, job->pid, job->cmdline);
+  if (bg == 0)
+    waitfg(pid);
+  else
+    printf("[%d] (%d) %s", job->jid, pid, cmdline);
+}
+
+/*
+ * xargswait - xargs is about to read its words from fd: handle job
+ *    events until fd is readable. Returns 1 if ctrl-c came first, which
+ *    gives the read up.
+ */
+int xargswait(int fd)
+{
+  int ev;
+
+  do {
+    ev = events_read(fd);
+    if (ev & EV_SIGNAL)
+      handleevents(0, 0);
+    if (interrupted)
+      return 1;
+  } while (!(ev & EV_INPUT));
+  return 0;
+}
+
+/*
+ * startbatch - start the next batch of an xargs job. It joins the
+ *    job's process group if join is set (the group still has a
+ *    member), and leads a new one otherwise. Returns its pid, 0 if
+ *    there is nothing more to run, or -1 if it could not be started.
+ */
+pid_t startbatch(struct xargs *xa, int join, int *forked)
+{
+  struct execcmd ecmd;
+  long long t = stats_now();
+  pid_t pid;
+
+  memset(&ecmd, 0, sizeof(ecmd));
+  ecmd.type = ' ';
+  if ((ecmd.argv = xargs_batch(xa)) == NULL)
+    return 0;
+  if (builtin_find(ecmd.argv[0]) == NULL)
+    ecmd.path = hash_find(&line_arena, ecmd.argv[0]);
+  if (!join)
+    xa->pgid = jobpgid;
+
+  *forked = 0;
+  pid = spawncmd((struct cmd *)&ecmd, &childmask, xa->pgid, xa->in, xa->out);
+  if (pid > 0) {
+    stats_time(PH_SPAWN, t);
+    stats_count(ST_SPAWNS);
+  } else if (pid == 0) {
+    *forked = 1;
+    pid = forkcmd((struct cmd *)&ecmd, &childmask, xa->pgid, xa->in, xa->out);
+    if (pid > 0) {
+      stats_time(PH_FORK, t);
+      stats_count(ST_FORKS);
+    }
+  }
+  if (pid < 0) {
+    xargs_done(xa, 0, -1, NULL);
+    return -1;
+  }
+  if (xa->pgid == 0)
+    xa->pgid = pid;
+  xargs_started(xa, pid);
+  return pid;
+}
+
+/*
+ * feedjob - start batches of an xargs job until -P (-j) of them are
+ *    running or there are none left. A stopped job gets no new ones.
+ */
+void feedjob(struct job_t *job)
+{
+  struct xargs *xa = job->xargs;
+  int forked;
+  pid_t pid;
+
+  while (job->state != ST && (xa->maxprocs == 0 || job->nlive < xa->maxprocs)) {
+    if ((pid = startbatch(xa, job->nlive > 0, &forked)) == 0)
+      break;
+    if (pid > 0) {
+      trackproc(addproc(&jobs, job, pid));
+      evtrace_add(forked ? TR_FORK : TR_SPAWN, pid, job->jid, 0);
+    }
+  }
+}
+
+/*
+ * pipeprefix - a pipeline may start with pipesize=SIZE to choose the
+ *    capacity of its own pipes, e.g. pipesize=1M sort < big | uniq.
+ *    Strips the word and returns the size, 0 if there is no prefix,
+ *    or -1 if the size is invalid (a message has been printed).
+ */
+int pipeprefix(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+  long size;
+  int i;
+
+  while (cmd->type != ' ')
+    cmd = cmd->type == '|' ? ((struct pipecmd *)cmd)->left
+                           : ((struct redircmd *)cmd)->cmd;
+  ecmd = (struct execcmd *)cmd;
+  if (ecmd->argv[0] == 0 || strncmp(ecmd->argv[0], "pipesize=", 9) != 0)
+    return 0;
+
+  size = parsesize(ecmd->argv[0] + 9);
+  if (size <= 0) {
+    printf("%s: invalid pipe size\n", ecmd->argv[0]);
+    return -1;
+  }
+  for (i = 0; ecmd->argv[i] != 0; i++)
+    ecmd->argv[i] = ecmd->argv[i + 1];
+  ecmd->argc--;
+  return size;
+}
+
+/*
+ * assignments - the NAME=value words a pipeline starts with. Alone,
+ *    they set shell variables (exported ones stay exported), and -1
+ *    is returned: there is nothing to run. Otherwise they are
+ *    exported for the pipeline with var_push, and their number is
+ *    returned for var_pop once it has been started (or has finished,
+ *    in the foreground).
+ */
+int assignments(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+  char *eq;
+  int i, n, pipe = cmd->type == '|';
+
+  while (cmd->type != ' ')
+    cmd = cmd->type == '|' ? ((struct pipecmd *)cmd)->left
+                           : ((struct redircmd *)cmd)->cmd;
+  ecmd = (struct execcmd *)cmd;
+  for (n = 0; ecmd->argv[n] != 0; n++)
+    if ((eq = strchr(ecmd->argv[n], '=')) == NULL ||
+        !var_valid(ecmd->argv[n], eq - ecmd->argv[n]))
+      break;
+  if (n == 0 || (ecmd->argv[n] == 0 && pipe))
+    return 0;
+  if (ecmd->argv[n] == 0) {
+    for (i = 0; i < n; i++)
+      var_assign(ecmd->argv[i], 0);
+    last_status = 0;
+    return -1;
+  }
+  for (i = 0; i < n; i++)
+    var_push(ecmd->argv[i]);
+  ecmd->argv += n;
+  ecmd->argc -= n;
+  return n;
+}
+
+/*
+ * parsesize - a byte count with an optional K, M or G suffix,
+ *    -1 if str is not one
+ */
+long parsesize(const char *str)
+{
+  char *end;
+  long n = strtol(str, &end, 10);
+
+  switch (toupper(*end)) {
+    case 'G': n <<= 10; /* fall through */
+    case 'M': n <<= 10; /* fall through */
+    case 'K': n <<= 10; end++;
+  }
+  if (end == str || *end != '\0' || n < 0 || n > INT_MAX)
+    return -1;
+  return n;
+}
+
+/*
+ * spawncmd - launch a simple command (a program plus its
+ *    redirections) with posix_spawn, which doesn't copy the shell's
+ *    page tables the way fork does. The child joins process group
+ *    pgid (0 makes a new one), reads from in and writes to out if
+ *    they are not -1, and starts with the signal mask in *mask.
+ *
+ *    Returns the child's pid, 0 if cmd is not a simple command (the
+ *    caller should fork instead), and -1 if it could not be started
+ *    (a message has been printed).
+ */
+pid_t spawncmd(struct cmd *cmd, sigset_t *mask, pid_t pgid, int in, int out)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  struct redircmd *rcmd;
+  struct execcmd *ecmd;
+  struct cmd *c;
+  pid_t pid;
+  int r, input = 0, fd, *here, nhere = 0, n = 0;
+
+  for (c = cmd; c->type == '<' || c->type == '>'; c = rcmd->cmd) {
+    rcmd = (struct redircmd *)c;
+    n++;
+  }
+  if (c->type != ' ')
+    return 0;
+  ecmd = (struct execcmd *)c;
+  if (ecmd->argv[0] == 0 || builtin_find(ecmd->argv[0]) != NULL)
+    return 0;
+  if (ecmd->path == NULL) {
+    printf("command %s not found\n", ecmd->argv[0]);
+    return -1;
+  }
+
+  /* pipes first, then redirections, which override them */
+  posix_spawn_file_actions_init(&actions);
+  if (in >= 0)
+    posix_spawn_file_actions_adddup2(&actions, in, 0);
+  if (out >= 0)
+    posix_spawn_file_actions_adddup2(&actions, out, 1);
+  /*
+   * redirections in the order runcmd applies them; here text goes in
+   * an fd made here, which the child gets a copy of
+   */
+  here = arena_alloc(&line_arena, n * sizeof(*here));
+  for (c = cmd; c->type == '<' || c->type == '>'; c = rcmd->cmd) {
+    rcmd = (struct redircmd *)c;
+    if (rcmd->how == '&') {
+      posix_spawn_file_actions_adddup2(&actions, rcmd->dupfd, rcmd->fd);
+    } else if (rcmd->how == 'h') {
+      if ((fd = heretext(rcmd->file)) < 0) {
+        printf("%s: %s\n", redirname(rcmd), strerror(errno));
+        posix_spawn_file_actions_destroy(&actions);
+        while (nhere > 0)
+          close(here[--nhere]);
+        return -1;
       }
+      here[nhere++] = fd;
+      posix_spawn_file_actions_adddup2(&actions, fd, rcmd->fd);
+    } else {
+      input |= rcmd->fd == 0;
+      posix_spawn_file_actions_addopen(&actions, rcmd->fd, rcmd->file,
+          rcmd->mode, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    }
+  }
+
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setpgroup(&attr, pgid);
+  posix_spawnattr_setsigmask(&attr, mask);
+
+  fflush(stdout);
+  r = posix_spawn(&pid, ecmd->path, &actions, &attr, ecmd->argv, environ);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  while (nhere > 0)
+    close(here[--nhere]);
+
+  if (r != 0) {
+    if (r == ENOENT && !input)
+      printf("command %s not found\n", ecmd->argv[0]);
+    else
+      printf("%s: %s\n", ecmd->argv[0], strerror(r));
+    return -1;
+  }
+  return pid;
+}
+
+/*
+ * forkcmd - the fallback for stages spawncmd can't handle: fork a
+ *    copy of the shell that sets itself up the same way and runs the
+ *    stage with runcmd
+ */
+pid_t forkcmd(struct cmd *cmd, sigset_t *mask, pid_t pgid, int in, int out)
+{
+  pid_t pid;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    printf("fork error: %s\n", strerror(errno));
+    return -1;
+  }
+  if (pid == 0) {
+    setpgid(0, pgid); // send SIGINT to the foreground job
+    sigprocmask(SIG_SETMASK, mask, NULL);
+    if (in >= 0)
+      dup2(in, 0);
+    if (out >= 0)
+      dup2(out, 1);
+    runcmd(cmd);
+  }
+  /* also in the parent, so it holds whichever runs first */
+  setpgid(pid, pgid ? pgid : pid);
+  return pid;
+}
+
+/*
+ * hashcmd - look up every program in a command tree in the command
+ *    hash, so the launcher (or forked child) can execve it directly
+ */
+void hashcmd(struct cmd *cmd)
+{
+  switch (cmd->type) {
+    case ' ':
+      if (((struct execcmd *)cmd)->argv[0] != 0 &&
+          builtin_find(((struct execcmd *)cmd)->argv[0]) == NULL)
+        ((struct execcmd *)cmd)->path = hash_find(&line_arena, ((struct execcmd *)cmd)->argv[0]);
+      break;
+    case '<':
+    case '>':
+      hashcmd(((struct redircmd *)cmd)->cmd);
+      break;
+    case '|':
+      hashcmd(((struct pipecmd *)cmd)->left);
+      hashcmd(((struct pipecmd *)cmd)->right);
+      break;
+  }
+}
+
+/*
+ * runcmd - run one pipeline stage in a forked child; never returns
+ */
+void runcmd(struct cmd *cmd) {
+  struct execcmd *ecmd;
+  struct redircmd *rcmd;
+  builtin_t *fn;
+  int fd;
+
+  if (is_listcmd(cmd))
+    subshell(cmd);
+  /* outermost first, the order they were written in */
+  while (cmd->type == '<' || cmd->type == '>') {
+    rcmd = (struct redircmd *)cmd;
+    fd = rcmd->how == '&' ? rcmd->dupfd : redirfd(rcmd);
+    if (fd < 0 || dup2(fd, rcmd->fd) < 0) {
+      printf("%s: %s\n", redirname(rcmd), strerror(errno));
+      exit(1);
+    }
+    if (fd == rcmd->fd)
+      fcntl(fd, F_SETFD, 0);
+    else if (rcmd->how != '&')
+      close(fd);
+    cmd = rcmd->cmd;
+  }
+  if (cmd->type != ' ') {
+    fprintf(stderr, "unknown runcmd\n");
+    exit(-1);
+  }
+
+  ecmd = (struct execcmd *)cmd;
+  if(ecmd->argv[0] == 0) {
+    exit(0);
+  }
+  if ((fn = builtin_find(ecmd->argv[0])) != NULL) {
+    dropcloexec();
+    exit(fn(ecmd->argv));
+  }
+  if (ecmd->path != NULL)
+    execve(ecmd->path, ecmd->argv, environ);
+  // filename not found
+  printf("command %s not found\n", ecmd->argv[0]);
+  exit(127);
+}
+
+/*
+ * heretext - an fd to read here-document text from: a pipe that holds
+ *    it already if it fits in one atomic write, otherwise a memfd, so
+ *    it is never written to a file or by a process of its own. -1
+ *    with errno set if it can't be made.
+ */
+int heretext(const char *text)
+{
+  size_t len = strlen(text);
+  ssize_t n;
+  int fds[2], fd;
+
+  if (len <= PIPE_BUF) {
+    if (pipe2(fds, O_CLOEXEC) < 0)
+      return -1;
+  } else {
+    if ((fds[0] = memfd_create("here", MFD_CLOEXEC)) < 0)
+      return -1;
+    fds[1] = fds[0];
+  }
+  for (fd = fds[1]; len > 0; text += n, len -= n) {
+    if ((n = write(fd, text, len)) < 0) {
+      close(fds[0]);
+      if (fd != fds[0])
+        close(fd);
+      return -1;
+    }
+  }
+  if (fd != fds[0])
+    close(fd);
+  else
+    lseek(fd, 0, SEEK_SET);
+  return fds[0];
+}
+
+/*
+ * redirfd - open the file or here text a redirection (not a >&) reads
+ *    or writes, close-on-exec; -1 with errno set on failure
+ */
+int redirfd(struct redircmd *r)
+{
+  if (r->how == 'h')
+    return heretext(r->file);
+  return open(r->file, r->mode | O_CLOEXEC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+}
+
+/* redirname - what to call a redirection in an error message */
+char *redirname(struct redircmd *r)
+{
+  return r->how == 'h' ? "here-document" : r->file;
+}
+
+/*
+ * cmdbuiltin - the builtin utility a simple command (with its
+ *    redirections) names, or NULL if it is not one
+ */
+builtin_t *cmdbuiltin(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
 
-      r = fork();
-      // ....
-      if (r < 0) {exit(-1);}
+  while (cmd->type == '<' || cmd->type == '>')
+    cmd = ((struct redircmd *)cmd)->cmd;
+  if (cmd->type != ' ')
+    return NULL;
+  ecmd = (struct execcmd *)cmd;
+  if (ecmd->argv[0] == 0)
+    return NULL;
+  return builtin_find(ecmd->argv[0]);
+}
 
-      if (r == 0) {
-        close(0);
-        pr = dup(p[0]);
-        if (pr != 0) { 
-          exit(-1); 
-        }
-        close(p[0]);
-        close(p[1]);
-        runcmd(pcmd->right);
-      } else {
-        close(1);
-        pr = dup(p[1]);
-        if (pr != 1) {
-          exit(-1);
-        }
-        close(p[0]);
-        close(p[1]);
-        runcmd(pcmd->left);
-      }
+/*
+ * runbuiltin - run a builtin utility in the shell itself. Its
+ *    redirections are applied to the shell's own fds in the order
+ *    runcmd applies them, and undone when it returns, so nothing is
+ *    forked. Returns its exit status.
+ */
+int runbuiltin(struct cmd *cmd, builtin_t *fn)
+{
+  struct redircmd **redirs;
+  struct cmd *c;
+  int *saved, fd, i, n = 0, status = 1;
+  int err = 0;
+  char *file = NULL;
+  long long t;
+
+  for (c = cmd; c->type == '<' || c->type == '>'; c = ((struct redircmd *)c)->cmd)
+    n++;
+  redirs = arena_alloc(&line_arena, n * sizeof(*redirs));
+  saved = arena_alloc(&line_arena, n * sizeof(*saved));
+  for (i = 0, c = cmd; i < n; i++, c = redirs[i - 1]->cmd)
+    redirs[i] = (struct redircmd *)c;
+
+  /* whatever the shell printed so far belongs to the old stdout */
+  if (n > 0)
+    fflush(stdout);
+  for (i = 0; i < n; i++) {
+    saved[i] = fcntl(redirs[i]->fd, F_DUPFD_CLOEXEC, 10);
+    fd = redirs[i]->how == '&' ? redirs[i]->dupfd : redirfd(redirs[i]);
+    if (fd < 0 || dup2(fd, redirs[i]->fd) < 0) {
+      err = errno;
+      if (fd >= 0 && redirs[i]->how != '&')
+        close(fd);
+      file = redirname(redirs[i++]);
       break;
+    }
+    if (fd == redirs[i]->fd)
+      fcntl(fd, F_SETFD, 0);
+    else if (redirs[i]->how != '&')
+      close(fd);
   }
-  // useless
-  exit(0);
-}
 
-/* 
- * parse_line - Parse the command line and build the argv array.
- * 
- * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.  
- */
-int parse_line(const char *cmdline, char **argv) 
-{
-    static char array[MAXLINE]; /* holds local copy of command line */
-    char *buf = array;          /* ptr that traverses command line */
-    char *delim;                /* points to first space delimiter */
-    int argc;                   /* number of args */
-    int bg;                     /* background job? */
-
-    strcpy(buf, cmdline);
-    buf[strlen(buf)-1] = ' ';  /* replace trailing '\n' with space */
-    while (*buf && (*buf == ' ')) /* ignore leading spaces */
-      buf++;
-
-    /* Build the argv list */
-    argc = 0;
-    if (*buf == '\'') {
-      buf++;
-      delim = strchr(buf, '\'');
+  if (file == NULL) {
+    waited = 0;
+    t = stats_now();
+    status = fn(((struct execcmd *)c)->argv);
+    stats_time(PH_BUILTIN, t + waited);
+    stats_count(ST_BUILTINS);
+    if (n > 0 && fflush(stdout) == EOF) {
+      clearerr(stdout);
+      status = 1;
     }
-    else {
-      delim = strchr(buf, ' ');
-    }
-
-    while (delim) {
-      argv[argc++] = buf;
-      *delim = '\0';
-      buf = delim + 1;
-      while (*buf && (*buf == ' ')) /* ignore spaces */
-        buf++;
+  }
 
-      if (*buf == '\'') {
-        buf++;
-        delim = strchr(buf, '\'');
-      }
-      else {
-        delim = strchr(buf, ' ');
-      }
+  /* put the shell's fds back, innermost first */
+  while (--i >= 0) {
+    if (saved[i] >= 0) {
+      dup2(saved[i], redirs[i]->fd);
+      close(saved[i]);
+    } else {
+      close(redirs[i]->fd);
     }
-    argv[argc] = NULL;
+  }
+  if (file != NULL)
+    printf("%s: %s\n", file, strerror(err));
+  return status;
+}
 
-    if (argc == 0)  /* ignore blank line */
-      return 1;
+/*
+ * dropcloexec - close what exec would have closed, for a forked child
+ *    that runs a builtin instead of a program: it must not keep the
+ *    other ends of its job's pipes open
+ */
+void dropcloexec(void)
+{
+  DIR *dir = opendir("/proc/self/fd");
+  struct dirent *ent;
+  int fd, flags;
 
-    /* should the job run in the background? */
-    if ((bg = (*argv[argc-1] == '&')) != 0) {
-      argv[--argc] = NULL;
-    }
-    return bg;
+  if (dir == NULL)
+    return;
+  while ((ent = readdir(dir)) != NULL) {
+    fd = atoi(ent->d_name);
+    if (fd <= 2 || fd == dirfd(dir))
+      continue;
+    flags = fcntl(fd, F_GETFD);
+    if (flags >= 0 && (flags & FD_CLOEXEC))
+      close(fd);
+  }
+  closedir(dir);
 }
 
 /* 
@@ -379,7 +1556,7 @@ int builtin_cmd(char **argv)
     fflush(stdout);
     exit(0);
   } else if (strcmp(argv[0], "jobs") == 0) {
-    listjobs(&jobs[0]);
+    listjobs(&jobs, argv[1] != NULL && strcmp(argv[1], "-l") == 0);
     return 1;
   } else if (strcmp(argv[0], "bg") == 0) {
     do_bgfg(argv);
@@ -396,6 +1573,27 @@ int builtin_cmd(char **argv)
   } else if (strcmp(argv[0], "environ") == 0) {
     do_environ();
     return 1;
+  } else if (strcmp(argv[0], "export") == 0) {
+    do_export(argv);
+    return 1;
+  } else if (strcmp(argv[0], "unset") == 0) {
+    do_unset(argv);
+    return 1;
+  } else if (strcmp(argv[0], "hash") == 0) {
+    do_hash(argv);
+    return 1;
+  } else if (strcmp(argv[0], "set") == 0) {
+    do_set(argv);
+    return 1;
+  } else if (strcmp(argv[0], "wait") == 0) {
+    do_wait(argv);
+    return 1;
+  } else if (strcmp(argv[0], "stats") == 0) {
+    do_stats(argv);
+    return 1;
+  } else if (strcmp(argv[0], "trace") == 0) {
+    do_trace(argv);
+    return 1;
   }
   return 0;     /* not a builtin command */
 }
@@ -413,117 +1611,175 @@ int alias_cmd(char **argv) {
   return 0;
 }
 
+/*
+ * findjob - the job arg names, as %jobid or PID; NULL if there is no
+ *    such job (a message has been printed)
+ */
+struct job_t *findjob(char *arg)
+{
+  int x;
+  struct job_t *job;
+
+  if (arg[0] == '%') { /* %jobid */
+    x = atoi(arg + 1);
+    job = getjobjid(&jobs, x);
+    if (job == NULL)
+      printf("%%%d: No such job\n", x);
+  } else { /* PID */
+    x = atoi(arg);
+    job = getjobpid(&jobs, x);
+    if (job == NULL)
+      printf("(%d): No such process\n", x);
+  }
+  return job;
+}
+
 /* 
  * do_bgfg - Execute the builtin bg and fg commands
  */
 void do_bgfg(char **argv) 
 {
-  int x;
   struct job_t *job;
 
+  last_status = 1;
   if (argv[1] == NULL) {
       printf("%s command requires PID or %%jobid argument\n", argv[0]);
       return;
   } 
 
   /* error handling */
-  if (argv[1][0] == '%') { /* fg|bg %jobid */
-    x = atoi(argv[1] + 1);
-    job = getjobjid(&jobs[0], x);
-    if (job == NULL) {
-      printf("%%%d: No such job\n", x);
-      return;
-    }
-  } else if ( isdigit(argv[1][0]) ) { /* bg|fg PID */
-    x = atoi(argv[1]);
-    job = getjobpid(&jobs[0], x);
-    if (job == NULL) {
-      printf("(%d): No such process\n", x);
-      return;
-    }
-  } else {
+  if (argv[1][0] != '%' && !isdigit(argv[1][0])) {
     printf("%s: argument must be a PID or %%jobid\n", argv[0]);
     return;
   }
+  if ((job = findjob(argv[1])) == NULL)
+    return;
+  last_status = 0;
 
   if (strcmp(argv[0], "bg") == 0) {
-    job->state = BG;
+    setjobstate(&jobs, job, BG);
+    evtrace_add(TR_STATE, job->pid, job->jid, BG);
     printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
 
-    kill(job->pid, SIGCONT);
+    // every process of the job was stopped
+    signaljob(job, SIGCONT);
   } else {
-    job->state = FG;
+    setjobstate(&jobs, job, FG);
+    evtrace_add(TR_STATE, job->pid, job->jid, FG);
     // send SIGCONT to all foreground processes
-    kill(-job->pid, SIGCONT);
+    signaljob(job, SIGCONT);
     waitfg(job->pid);
   }
 
   return;
 }
 
+/*
+ * do_wait - wait [%jobid | PID ...] and wait -n
+ *    Wait for the given jobs, or for every running job, to finish,
+ *    and take the status of the last one. wait -n returns as soon as
+ *    any job finishes. ctrl-c stops the wait.
+ */
+void do_wait(char **argv)
+{
+  struct job_t *job;
+  int i, jid, status = 0;
+
+  if (argv[1] != NULL && strcmp(argv[1], "-n") == 0) {
+    for (jid = 1; jid <= maxjid(&jobs); jid++)
+      if ((job = getjobjid(&jobs, jid)) != NULL && job->state == BG)
+        break;
+    status = jid <= maxjid(&jobs) ? waitjob(-1) : 127;
+  } else if (argv[1] == NULL) {
+    /* one at a time, until no job is left running */
+    for (jid = 1; jid <= maxjid(&jobs) && status >= 0; jid++)
+      if ((job = getjobjid(&jobs, jid)) != NULL && job->state == BG)
+        status = waitjob(jid) < 0 ? -1 : 0;
+  } else {
+    for (i = 1; argv[i] != NULL && status >= 0; i++) {
+      if (argv[i][0] != '%' && !isdigit(argv[i][0])) {
+        printf("wait: %s: argument must be a PID or %%jobid\n", argv[i]);
+        status = 2;
+      } else if ((job = findjob(argv[i])) == NULL) {
+        status = 127;
+      } else if (job->state == ST) {
+        status = 128 + SIGTSTP;
+      } else {
+        status = waitjob(job->jid);
+      }
+    }
+  }
+  last_status = status < 0 ? 128 + SIGINT : status;
+}
+
+/*
+ * waitjob - wait until job jid (any job if -1) finishes or stops and
+ *    return its status, or -1 if ctrl-c came first. The time counts as
+ *    PH_WAIT, as in waitfg.
+ */
+int waitjob(int jid)
+{
+  long long t = stats_now();
+
+  waitjid = jid;
+  while (waitjid != 0)
+    handleevents(0, -1);
+  waited += stats_time(PH_WAIT, t) - t;
+  return waitstatus;
+}
 
-/**
- * find str in argv, if failed return -1
+/*
+ * signaljob - send sig to every process of a job. While the leader is
+ *    unreaped its pid, the job's process group ID, can't be recycled,
+ *    so kill reaches the whole group, grandchildren included. After
+ *    that each live stage is signalled through its pidfd, which can
+ *    never hit a process that merely reuses an old pid.
  */
-int find_arg(char** argv, char* str) {
-  int i = 0;
-  while (argv[i] != NULL) {
-    if (strcmp(argv[i], str) == 0)
-      return i;
-    i++;
+void signaljob(struct job_t *job, int sig)
+{
+  struct proc_t *proc = getproc(&jobs, job->pid);
+
+  evtrace_add(TR_SIGNAL, job->pid, job->jid, sig);
+  if (proc != NULL && !proc->done) {
+    kill(-job->pid, sig);
+    return;
   }
-  return -1;
+  for (proc = job->procs; proc != NULL; proc = proc->next)
+    if (proc->pidfd >= 0)
+      pidfd_send_signal(proc->pidfd, sig, NULL, 0);
 }
 
-/**
- * redirecting IO
- * because the parse_commandline is very poor,
- * "<", ">" should be placed at the end of command
- * like: echo hello < gaga
- */
-void redirecting(char **argv){ 
-  int inIndex = find_arg(argv, "<");
-  int outIndex = find_arg(argv, ">");
-  int appIndex = find_arg(argv, ">>");
-
-  if (inIndex >= 0) {
-    int in = open(argv[inIndex + 1], O_RDONLY);
-    if (in < 0) {
-      printf("File %s not exist\n", argv[inIndex + 1]);
-      exit(-1);
-    }
-    dup2(in, STDIN_FILENO);
-    close(in);
-    argv[inIndex] = NULL;
-  }
-  if (outIndex >= 0) {
-    // O_TRUNC: remove previous results
-    int out = open(argv[outIndex + 1], O_WRONLY | O_TRUNC);
-    if (out < 0) {
-      printf("File %s not exist\n", argv[outIndex + 1]);
-      exit(-1);
-    }
-    dup2(out, STDOUT_FILENO);
-    close(out);
-    argv[outIndex] = NULL;
-  }
-  if (appIndex >= 0) {
-    int ad = open(argv[appIndex + 1], O_RDWR | O_APPEND);
-    if (ad < 0) {
-      printf("File %s not exist!\n", argv[appIndex + 1]);
-      exit(-1);
-    }
-    dup2(ad, STDOUT_FILENO);
-    close(ad);
-    argv[appIndex] = NULL;
+/*
+ * trackproc - open a pidfd for a process the shell just started (it
+ *    can't have been reaped yet, so the pid is still its own) and let
+ *    the event loop wake up when it exits
+ */
+void trackproc(struct proc_t *proc)
+{
+  proc->pidfd = pidfd_open(proc->pid, 0);
+  if (proc->pidfd >= 0 && events_add(proc->pidfd) < 0) {
+    close(proc->pidfd);
+    proc->pidfd = -1;
   }
 }
 
+/* untrackproc - drop a reaped process's pidfd */
+void untrackproc(struct proc_t *proc)
+{
+  if (proc->pidfd < 0)
+    return;
+  events_del(proc->pidfd);
+  close(proc->pidfd);
+  proc->pidfd = -1;
+}
+
 /**
  * pwd - show the current working directory.
  */
 void do_pwd(char **argv) {
   char ptr[MAXPATH];
+
+  (void)argv;
   if (getcwd(ptr, sizeof(ptr)) != NULL)
     printf("%s\n", ptr);
 }
@@ -537,9 +1793,10 @@ void do_cd(char **argv){
   int ret = chdir(argv[1]);
   if (ret != 0) {
     printf("cd: %s: the directory not found.\n", argv[1]);
+    last_status = 1;
   } else {
-    setenv("PWD", getcwd(ptr, sizeof(ptr)), 1);
-    printf("%s\n", getenv("PWD"));
+    var_set("PWD", getcwd(ptr, sizeof(ptr)), 1);
+    printf("%s\n", var_get("PWD"));
   }
 }
 
@@ -549,54 +1806,238 @@ void do_cd(char **argv){
  * only show first SHOW_LEN chars..
  */
 void do_environ(){
-  char subbuff[MAXLINE];
+  char subbuff[SHOW_LEN + 4];
+  char **envp = var_envp();
   int i = 0;
-  while(environ[i] != NULL) {
-    int len = strlen(environ[i]) ; 
-    //printf("[%d]%s\n", len, environ[i]);
+  while(envp[i] != NULL) {
+    int len = strlen(envp[i]) ; 
     if (len > SHOW_LEN) {
-      strncpy(subbuff, environ[i], SHOW_LEN);
+      strncpy(subbuff, envp[i], SHOW_LEN);
       subbuff[SHOW_LEN] = '.';
       subbuff[SHOW_LEN + 1] = '.';
       subbuff[SHOW_LEN + 2] = '.';
       subbuff[SHOW_LEN + 3] = '\0';
       printf("%s\n", subbuff);
     } else {
-      printf("%s\n", environ[i]);
+      printf("%s\n", envp[i]);
     }
     i++; 
   }
 }
 
+/**
+ * export - export shell variables to the commands the shell runs
+ *   export              list the exported ones, like environ but whole
+ *   export NAME[=value]...
+ */
+void do_export(char **argv) {
+  char **envp = var_envp();
+  int i;
+
+  if (argv[1] == NULL) {
+    for (i = 0; envp[i] != NULL; i++)
+      printf("export %s\n", envp[i]);
+    return;
+  }
+  for (i = 1; argv[i] != NULL; i++) {
+    if (strchr(argv[i], '=') != NULL ? var_assign(argv[i], 1) < 0
+                                            : var_export(argv[i]) < 0) {
+      printf("export: %s: not a valid name\n", argv[i]);
+      last_status = 1;
+    }
+  }
+}
+
+/**
+ * unset - forget shell variables
+ */
+void do_unset(char **argv) {
+  int i;
+
+  for (i = 1; argv[i] != NULL; i++)
+    var_unset(argv[i]);
+}
+
+/**
+ * hash - show or change the remembered command locations
+ *   hash            list them with their hit counts
+ *   hash -r         forget them all
+ *   hash name...    look the names up now
+ */
+void do_hash(char **argv) {
+  int i;
+
+  hash_check();
+  if (argv[1] == NULL) {
+    hash_list();
+  } else if (strcmp(argv[1], "-r") == 0) {
+    hash_clear();
+  } else {
+    for (i = 1; argv[i] != NULL; i++)
+      if (hash_find(&line_arena, argv[i]) == NULL)
+        printf("hash: %s: not found\n", argv[i]);
+  }
+}
+
+/**
+ * set - change shell options
+ *   set -o           list the options
+ *   set -o pipefail  a pipeline's status is that of its last failing stage
+ *   set +o pipefail  ... or that of its last stage (the default)
+ *   set -o pipesize=SIZE  capacity of the pipes in pipelines (0: default)
+ */
+void do_set(char **argv) {
+  long size;
+
+  if (argv[1] == NULL || (strcmp(argv[1], "-o") == 0 && argv[2] == NULL)) {
+    printf("pipefail\t%s\n", pipefail ? "on" : "off");
+    printf("pipesize\t%d\n", pipesize);
+  } else if ((strcmp(argv[1], "-o") == 0 || strcmp(argv[1], "+o") == 0)
+      && strcmp(argv[2], "pipefail") == 0) {
+    pipefail = argv[1][0] == '-';
+  } else if (strcmp(argv[1], "-o") == 0 && strncmp(argv[2], "pipesize=", 9) == 0) {
+    if ((size = parsesize(argv[2] + 9)) < 0)
+      printf("set: %s: invalid pipe size\n", argv[2]);
+    else
+      pipesize = size;
+  } else {
+    printf("set: usage: set [-o|+o pipefail] [-o pipesize=SIZE]\n");
+  }
+}
+
+/*
+ * do_stats - stats [-j | -r]: print the phase latencies and counters,
+ *    as a table or (-j) as JSON, or (-r) reset them
+ */
+void do_stats(char **argv)
+{
+  if (argv[1] == NULL)
+    stats_print(stdout);
+  else if (strcmp(argv[1], "-j") == 0)
+    stats_json(stdout);
+  else if (strcmp(argv[1], "-r") == 0)
+    stats_reset();
+  else
+    printf("stats: usage: stats [-j | -r]\n");
+}
+
+/*
+ * do_trace - trace dump FILE | trace clear | trace: write the job
+ *    event ring to FILE as Chrome trace-event JSON, empty it, or say
+ *    how many events it holds
+ */
+void do_trace(char **argv)
+{
+  if (argv[1] == NULL) {
+    printf("trace: %ld events\n", evtrace_count());
+  } else if (strcmp(argv[1], "clear") == 0) {
+    evtrace_clear();
+  } else if (strcmp(argv[1], "dump") == 0 && argv[2] != NULL) {
+    if (evtrace_dump(argv[2]) < 0)
+      printf("trace: %s: %s\n", argv[2], strerror(errno));
+  } else {
+    printf("trace: usage: trace [dump FILE | clear]\n");
+  }
+}
+
+/*
+ * dumpstats - at exit, write the stats as JSON to the file named by
+ *    TSH_STATS, or to stdout under -v
+ */
+void dumpstats(void)
+{
+  char *file = getenv("TSH_STATS");
+  FILE *fp;
+
+  if (getpid() != shellpid)
+    return;
+  if (file == NULL || *file == '\0') {
+    stats_json(stdout);
+    return;
+  }
+  if ((fp = fopen(file, "w")) == NULL) {
+    printf("%s: %s\n", file, strerror(errno));
+    return;
+  }
+  stats_json(fp);
+  fclose(fp);
+}
+
 /* 
  * waitfg - Block until process pid is no longer the foreground process
+ *
+ * Only the signalfd is waited on, so lines already queued on the
+ * input don't wake us; the job's state changes in reapchildren.
  */
 void waitfg(pid_t pid)
 {
-  while ( fgpid(&jobs[0]) == pid ) {
-    sleep(1);
+  long long t = stats_now();
+
+  while ( fgpid(&jobs) == pid ) {
+    handleevents(0, -1);
   }
-  //printf("waitfg ok\n");
+  waited += stats_time(PH_WAIT, t) - t;
   return;
 }
 
 /*****************
- * Signal handlers
+ * Signal events
  *****************/
 
+/*
+ * handleevents - wait up to timeout ms (-1 for ever) for a signal, or
+ *    for input too if input is set, and act on the signals that came.
+ *    Returns 1 if there is input to read.
+ */
+int handleevents(int input, int timeout)
+{
+  struct signalfd_siginfo si;
+  int ev, chld = 0;
+
+  ev = events_wait(input, timeout);
+  if (ev & (EV_SIGNAL | EV_CHILD)) {
+    while (events_signal(&si)) {
+      if (si.ssi_signo == SIGCHLD)
+        chld = 1;     /* one reap covers every child that changed */
+      else
+        forwardsig(si.ssi_signo);
+    }
+    if (chld || (ev & EV_CHILD))
+      reapchildren();
+    /* sitting idle at the prompt: show what happened right away */
+    if (input)
+      fflush(stdout);
+  }
+  return (ev & EV_INPUT) != 0;
+}
+
+/*
+ * waitinput - the reader is about to read: handle job events until
+ *    there is input, so background jobs are reaped and reported while
+ *    the shell waits for the next line
+ */
+void waitinput(void)
+{
+  while (!handleevents(1, -1))
+    ;
+}
+
 /* 
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.  
+ * reapchildren - called when SIGCHLD came in: a child terminated
+ *     (became a zombie), or stopped because it received a SIGSTOP or
+ *     SIGTSTP signal. Reaps all available zombie children, but
+ *     doesn't wait for any other currently running children to
+ *     terminate.
  */
-void sigchld_handler(int sig) 
+void reapchildren(void) 
 {
   // do not wait for any other running children
   pid_t pid;
   int status;
-  int signo;
+  siginfo_t info;
+  struct rusage ru;
+  struct proc_t *proc;
+  struct job_t *job;
 
   /**
    * -- WNOHANG
@@ -606,236 +2047,133 @@ void sigchld_handler(int sig)
    * suspend execution of the calling process until a process
    * in the wait set becomes either terminated or stopped.
    */
-  while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-    //printf("pid of sigchld = %d\n", pid);
-
-    if ( WIFEXITED(status) ) { 
-      // normally exit
-      deletejob(&jobs[0], pid);
-    } else if ( WIFSTOPPED(status) ) {
-      // SIGTSTP
-      signo = WSTOPSIG(status);
-      if (signo == SIGTSTP) {
-        struct job_t* job = getjobpid(&jobs[0], pid);
+  /* a subshell stops along with its children, so it ignores that */
+  while (waitid(P_ALL, 0, &info, WEXITED | (insubshell ? 0 : WSTOPPED) | WNOHANG | WNOWAIT) == 0
+      && info.si_pid != 0) {
+    /*
+     * peek first: a pipeline stage's I/O counters can still be read
+     * while it is a zombie, but not once it has been reaped
+     */
+    pid = info.si_pid;
+    proc = getproc(&jobs, pid);
+    if (proc != NULL && proc->job->procs->next != NULL && info.si_code != CLD_STOPPED)
+      readio(proc);
+    if (wait4(pid, &status, WNOHANG | (insubshell ? 0 : WUNTRACED), &ru) <= 0 || proc == NULL)
+      continue;
+    job = proc->job;
+    if ( WIFSTOPPED(status) ) {
+      // SIGTSTP: every stage stops, report the job once
+      evtrace_add(TR_STOP, pid, job->jid, WSTOPSIG(status));
+      if (job->state != ST) {
         printf("Job [%d] (%d) stopped by signal %d\n",
-            job->jid, pid, signo);
+            job->jid, job->pid, WSTOPSIG(status));
         // update the Job state to stop
-        job->state = ST;
+        setjobstate(&jobs, job, ST);
+        evtrace_add(TR_STATE, job->pid, job->jid, ST);
       }
-    } else if ( WTERMSIG(status) == SIGINT ) {
-      // SIGINT
+      if (waitjid == job->jid) {
+        waitstatus = 128 + WSTOPSIG(status);
+        waitjid = 0;
+      }
+      continue;
+    }
+    untrackproc(proc);
+    procusage(proc, &ru);
+    stats_count(ST_REAPED);
+    evtrace_add(TR_EXIT, pid, job->jid, status);
+
+    if ( WIFSIGNALED(status) && WTERMSIG(status) != SIGPIPE && !job->reported ) {
+      // e.g. SIGINT, which reaches every stage
       printf("Job [%d] (%d) terminated by signal %d\n", 
-          pid2jid(pid), pid, SIGINT);
-      deletejob(&jobs[0], pid);
+          job->jid, job->pid, WTERMSIG(status));
+      job->reported = 1;
+    }
+    procdone(proc, status);
+    if (job->xargs != NULL) {
+      /* start the next batches, and forget this one if the job goes on */
+      xargs_done(job->xargs, pid, status, &ru);
+      feedjob(job);
+      if (job->nlive > 0) {
+        dropproc(&jobs, proc);
+        continue;
+      }
+    }
+    if (job->nlive == 0) {
+      status = job->xargs ? job->xargs->status : jobstatus(job, pipefail);
+      if (job->state == FG) {
+        last_status = status;
+        addusage(&fgusage, &job->usage);
+      }
+      if (waitjid == -1 || waitjid == job->jid) {
+        waitstatus = status;
+        waitjid = 0;
+      }
+      if (verbose && job->procs->next != NULL)
+        for (proc = job->procs; proc != NULL; proc = proc->next)
+          printf("Job [%d] (%d) read %lld wrote %lld bytes\n",
+              job->jid, proc->pid, proc->rchar, proc->wchar);
+      if (job->xargs != NULL) {
+        if (verbose) {
+          printf("Job [%d] (%d) ", job->jid, job->pid);
+          xargs_summary(job->xargs);
+        }
+        xargs_free(job->xargs);
+      }
+      deletejob(&jobs, pid);
     }
   } 
 
   return;
 }
 
-/* 
- * sigint_handler - The kernel sends a SIGINT to the shell whenver the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.  
+/*
+ * readio - record how many bytes a process has read and written, from
+ *    the rchar and wchar lines of /proc/PID/io
  */
-void sigint_handler(int sig) 
+void readio(struct proc_t *proc)
 {
-  // find fg pid by fgpid
-  pid_t pid = fgpid(&jobs[0]);
-  if (pid == 0) {
+  char buf[512], *p;
+  int fd, n;
+
+  snprintf(buf, sizeof(buf), "/proc/%d/io", proc->pid);
+  if ((fd = open(buf, O_RDONLY)) < 0)
     return;
-  }
-  /**
-   * Negative PID values may be  used  to  choose  whole
-   * process  groups
-   */
-  kill(-pid, SIGINT);
-  printf("Job [%d] (%d) terminated by signal %d\n", 
-      pid2jid(pid), pid, sig);
-  deletejob(&jobs[0], pid);
-  return;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return;
+  buf[n] = '\0';
+  if ((p = strstr(buf, "rchar: ")) != NULL)
+    proc->rchar = strtoll(p + 7, NULL, 10);
+  if ((p = strstr(buf, "wchar: ")) != NULL)
+    proc->wchar = strtoll(p + 7, NULL, 10);
 }
 
-/*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.  
+/* 
+ * forwardsig - The kernel sends a SIGINT (SIGTSTP) to the shell
+ *    whenever the user types ctrl-c (ctrl-z) at the keyboard. Send it
+ *    along to the foreground job; reapchildren reports what happens.
  */
-void sigtstp_handler(int sig) 
+void forwardsig(int sig) 
 {
-  pid_t pid = fgpid(&jobs[0]);
-  //printf("debug: pid= %d\n", pid);
-  if (pid == 0) {
+  if (sig == SIGINT)
+    interrupted = 1;
+  if (jobs.fg == NULL) {
+    // ctrl-c breaks out of the wait builtin
+    if (sig == SIGINT && waitjid != 0) {
+      waitstatus = -1;
+      waitjid = 0;
+    }
     return;
   }
-  kill(-pid, SIGTSTP);
-  struct job_t* job = getjobpid(&jobs[0], pid);
-  printf("Job [%d] (%d) stopped by signal %d\n",
-      job->jid, pid, sig);
-  // update the Job state to stop
-  job->state = ST;
+  signaljob(jobs.fg, sig);
   return;
 }
 
 /*********************
- * End signal handlers
+ * End signal events
  *********************/
 
-/***********************************************
- * Helper routines that manipulate the job list
- **********************************************/
-
-/* clearjob - Clear the entries in a job struct */
-void clearjob(struct job_t *job) {
-    job->pid = 0;
-    job->jid = 0;
-    job->state = UNDEF;
-    job->cmdline[0] = '\0';
-}
-
-/* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs) {
-    int i;
-
-    for (i = 0; i < MAXJOBS; i++)
-	clearjob(&jobs[i]);
-}
-
-/* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs) 
-{
-  int i, max=0;
-
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].jid > max)
-      max = jobs[i].jid;
-  return max;
-}
-
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) 
-{
-  int i;
-
-  if (pid < 1)
-    return 0;
-
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == 0) {
-      jobs[i].pid = pid;
-      jobs[i].state = state;
-      jobs[i].jid = nextjid++;
-      if (nextjid > MAXJOBS)
-        nextjid = 1;
-      strcpy(jobs[i].cmdline, cmdline);
-      if(verbose){
-        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-      }
-      return 1;
-    }
-  }
-  printf("Tried to create too many jobs\n");
-  return 0;
-}
-
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid) 
-{
-  int i;
-
-  if (pid < 1)
-    return 0;
-
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == pid) {
-      clearjob(&jobs[i]);
-      nextjid = maxjid(jobs)+1;
-      return 1;
-    }
-  }
-  return 0;
-}
-
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs) {
-  int i;
-
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].state == FG)
-      return jobs[i].pid;
-  return 0;
-}
-
-/* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-  int i;
-
-  if (pid < 1)
-    return NULL;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].pid == pid)
-      return &jobs[i];
-  return NULL;
-}
-
-/* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid) 
-{
-    int i;
-
-    if (jid < 1)
-	return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].jid == jid)
-	    return &jobs[i];
-    return NULL;
-}
-
-/* pid2jid - Map process ID to job ID */
-int pid2jid(pid_t pid) 
-{
-    int i;
-
-    if (pid < 1)
-	return 0;
-    for (i = 0; i < MAXJOBS; i++)
-	if (jobs[i].pid == pid) {
-            return jobs[i].jid;
-        }
-    return 0;
-}
-
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs) 
-{
-  int i;
-
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid != 0) {
-      printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-      switch (jobs[i].state) {
-        case BG: 
-          printf("Running ");
-          break;
-        case FG: 
-          printf("Foreground ");
-          break;
-        case ST: 
-          printf("Stopped ");
-          break;
-        default:
-          printf("listjobs: Internal error: job[%d].state=%d ", 
-              i, jobs[i].state);
-      }
-      printf("%s", jobs[i].cmdline);
-    }
-  }
-}
-/******************************
- * end job list helper routines
- ******************************/
-
-
 /***********************
  * Other helper routines
  ***********************/
@@ -845,10 +2183,11 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvp] [-c command | script] [args...]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -c   run command instead of reading stdin\n");
     exit(1);
 }
 
@@ -892,6 +2231,7 @@ handler_t *Signal(int signum, handler_t *handler)
  */
 void sigquit_handler(int sig) 
 {
+    (void)sig;
     printf("Terminating after receipt of SIGQUIT signal\n");
     exit(1);
 }
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "vars.h"
+#include "stats.h"
+
+#define NBUCKETS    256  /* buckets in the variable table */
+
+extern char **environ;      /* defined in libc */
+
+struct var {
+  char *str;                /* "NAME=value" */
+  int namelen;
+  int exported;
+  struct var *next;         /* in the bucket */
+  struct var *older, *newer; /* in the order they were first set */
+};
+
+static struct var *table[NBUCKETS];
+static struct var *oldest, *newest;
+static char **envp;         /* the exported ones, what environ points to */
+static int envcap;
+
+struct saved {              /* what var_push replaced */
+  char *name;
+  char *str;                /* the old NAME=value, NULL if it was unset */
+  int exported;
+};
+
+static struct saved *stack;
+static int nstack, stackcap;
+
+static unsigned strhash(const char *s, int len)
+{
+  unsigned h = 5381;
+  while (len-- > 0)
+    h = h * 33 + (unsigned char)*s++;
+  return h % NBUCKETS;
+}
+
+/* lookup - the variable called name (len bytes), or NULL */
+static struct var *lookup(const char *name, int len)
+{
+  struct var *v;
+
+  for (v = table[strhash(name, len)]; v != NULL; v = v->next)
+    if (v->namelen == len && memcmp(v->str, name, len) == 0)
+      return v;
+  return NULL;
+}
+
+/*
+ * rebuild - Point envp at the exported variables again, after one of
+ *    them changed. Only pointers are copied.
+ */
+static void rebuild(void)
+{
+  struct var *v;
+  int n = 0;
+
+  for (v = oldest; v != NULL; v = v->newer)
+    n += v->exported;
+  if (n + 1 > envcap) {
+    envcap = envcap ? envcap : 64;
+    while (envcap < n + 1)
+      envcap *= 2;
+    envp = realloc(envp, envcap * sizeof(char *));
+  }
+  n = 0;
+  for (v = oldest; v != NULL; v = v->newer)
+    if (v->exported)
+      envp[n++] = v->str;
+  envp[n] = NULL;
+  environ = envp;
+  stats_count(ST_ENVBUILDS);
+}
+
+/*
+ * setvar - Give the variable name (len bytes) a value, creating it if
+ *    need be. Nothing is rebuilt; returns 1 if envp must be.
+ */
+static int setvar(const char *name, int len, const char *value, int export)
+{
+  struct var *v = lookup(name, len);
+  size_t vlen = strlen(value);
+  unsigned h;
+
+  if (v == NULL) {
+    v = malloc(sizeof(*v));
+    v->namelen = len;
+    v->exported = 0;
+    v->str = NULL;
+    h = strhash(name, len);
+    v->next = table[h];
+    table[h] = v;
+    v->older = newest;
+    v->newer = NULL;
+    if (newest != NULL)
+      newest->newer = v;
+    else
+      oldest = v;
+    newest = v;
+  }
+  free(v->str);
+  v->str = malloc(len + vlen + 2);
+  memcpy(v->str, name, len);
+  v->str[len] = '=';
+  memcpy(v->str + len + 1, value, vlen + 1);
+  if (export)
+    v->exported = 1;
+  return v->exported;
+}
+
+/* var_init - Take in the environment the shell was started with */
+void var_init(char **env)
+{
+  const char *eq;
+  int i;
+
+  for (i = 0; env[i] != NULL; i++)
+    if ((eq = strchr(env[i], '=')) != NULL && eq > env[i])
+      setvar(env[i], eq - env[i], eq + 1, 1);
+  rebuild();
+}
+
+/*
+ * var_valid - true if name (len bytes) can name a variable: a letter
+ *    or _, then letters, digits and _
+ */
+int var_valid(const char *name, int len)
+{
+  int i;
+
+  if (len <= 0 || isdigit((unsigned char)name[0]))
+    return 0;
+  for (i = 0; i < len; i++)
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_')
+      return 0;
+  return 1;
+}
+
+/* var_get - The value of variable name, or NULL if it is not set */
+const char *var_get(const char *name)
+{
+  return var_getn(name, strlen(name));
+}
+
+/* var_getn - var_get for a name that is the first len bytes of name */
+const char *var_getn(const char *name, int len)
+{
+  struct var *v = lookup(name, len);
+
+  return v != NULL ? v->str + len + 1 : NULL;
+}
+
+/* var_set - Set variable name to value */
+int var_set(const char *name, const char *value, int export)
+{
+  int len = strlen(name);
+
+  if (!var_valid(name, len))
+    return -1;
+  if (setvar(name, len, value, export))
+    rebuild();
+  return 0;
+}
+
+/* var_assign - Set a variable from a NAME=value word */
+int var_assign(const char *word, int export)
+{
+  const char *eq = strchr(word, '=');
+
+  if (eq == NULL || !var_valid(word, eq - word))
+    return -1;
+  if (setvar(word, eq - word, eq + 1, export))
+    rebuild();
+  return 0;
+}
+
+/*
+ * var_export - Export variable name, which is set to the empty string
+ *    first if it is not set
+ */
+int var_export(const char *name)
+{
+  struct var *v;
+  int len = strlen(name);
+
+  if (!var_valid(name, len))
+    return -1;
+  if ((v = lookup(name, len)) == NULL)
+    return var_set(name, "", 1);
+  if (!v->exported) {
+    v->exported = 1;
+    rebuild();
+  }
+  return 0;
+}
+
+/* var_unset - Forget variable name, if it is set */
+void var_unset(const char *name)
+{
+  struct var **p, *v;
+  int len = strlen(name);
+
+  for (p = &table[strhash(name, len)]; (v = *p) != NULL; p = &v->next)
+    if (v->namelen == len && memcmp(v->str, name, len) == 0)
+      break;
+  if (v == NULL)
+    return;
+  *p = v->next;
+  if (v->older != NULL)
+    v->older->newer = v->newer;
+  else
+    oldest = v->newer;
+  if (v->newer != NULL)
+    v->newer->older = v->older;
+  else
+    newest = v->older;
+  if (v->exported)
+    rebuild();
+  free(v->str);
+  free(v);
+}
+
+/*
+ * var_push - Set and export a variable from a NAME=value word for the
+ *    command it comes before, remembering what it was
+ */
+int var_push(const char *word)
+{
+  const char *eq = strchr(word, '=');
+  struct saved *s;
+  struct var *v;
+
+  if (eq == NULL || !var_valid(word, eq - word))
+    return -1;
+  if (nstack == stackcap) {
+    stackcap = stackcap ? stackcap * 2 : 8;
+    stack = realloc(stack, stackcap * sizeof(*stack));
+  }
+  s = &stack[nstack++];
+  s->name = strndup(word, eq - word);
+  v = lookup(word, eq - word);
+  s->str = v != NULL ? strdup(v->str) : NULL;
+  s->exported = v != NULL && v->exported;
+  setvar(word, eq - word, eq + 1, 1);
+  rebuild();
+  return 0;
+}
+
+/* var_pop - Undo the last n var_push calls */
+void var_pop(int n)
+{
+  struct saved *s;
+  int len;
+
+  while (n-- > 0 && nstack > 0) {
+    s = &stack[--nstack];
+    len = strlen(s->name);
+    if (s->str == NULL) {
+      var_unset(s->name);
+    } else {
+      setvar(s->name, len, s->str + len + 1, 0);
+      lookup(s->name, len)->exported = s->exported;
+      rebuild();
+    }
+    free(s->name);
+    free(s->str);
+  }
+}
+
+/* var_envp - The exported variables as NAME=value strings */
+char **var_envp(void)
+{
+  return envp;
+}
@@ -0,0 +1,28 @@
+#ifndef FILE_VARS
+#define FILE_VARS
+
+/*
+ * The shell's variables: a hash table of NAME=value strings, each with
+ * an export flag. The exported ones are also kept in an envp vector,
+ * in the order they were first set, and environ points to it. The
+ * vector is rebuilt (pointers only) when an exported variable is set,
+ * exported or unset, so launching a command copies nothing, and
+ * getenv, execve and posix_spawn see the shell's variables as they are.
+ *
+ * var_set and var_assign export the variable if export is set, and
+ * otherwise leave its flag alone; they return -1 for a bad name.
+ * var_push is var_assign for the NAME=value words before a command:
+ * the variable is exported until var_pop puts back what it was.
+ */
+void var_init(char **envp);
+int var_valid(const char *name, int len);
+const char *var_get(const char *name);
+const char *var_getn(const char *name, int len);
+int var_set(const char *name, const char *value, int export);
+int var_assign(const char *word, int export);
+int var_export(const char *name);
+void var_unset(const char *name);
+int var_push(const char *word);
+void var_pop(int n);
+char **var_envp(void);
+#endif
@@ -0,0 +1,649 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "builtins.h"
+#include "stats.h"
+#include "xargs.h"
+
+#define HEADROOM    2048     /* ARG_MAX bytes left for the exec itself */
+
+extern char **environ;
+
+/* name - the command, for messages */
+static const char *name(struct xargs *xa)
+{
+  return xa->each ? "parallel" : "xargs";
+}
+
+/* number - a count option's value, or -1 (after a message) */
+static long number(struct xargs *xa, const char *str, int min)
+{
+  char *end;
+  long n = strtol(str, &end, 10);
+
+  if (*end != '\0' || end == str || n < min) {
+    printf("%s: %s: invalid number\n", name(xa), str);
+    return -1;
+  }
+  return n;
+}
+
+/* setcmd - copy the n command words, or dflt if there are none */
+static int setcmd(struct xargs *xa, char **words, int n, const char *dflt)
+{
+  int i;
+
+  xa->ncmd = n ? n : dflt != NULL;
+  xa->cmd = calloc(xa->ncmd + 1, sizeof(char *));
+  if (xa->cmd == NULL)
+    return -1;
+  for (i = 0; i < xa->ncmd; i++)
+    if ((xa->cmd[i] = strdup(n ? words[i] : dflt)) == NULL)
+      return -1;
+  return 0;
+}
+
+static int readall(struct xargs *xa, int fd, const char *head, size_t n, size_t *lenp);
+static int cut(struct xargs *xa, size_t len);
+
+/*
+ * xargs_new - the state for one xargs or parallel command line, or NULL
+ *    (after a message) if its options are wrong. The command words are
+ *    copied, so it can outlive argv. parallel's ::: and :::: items are
+ *    loaded here; otherwise they come from xargs_read.
+ */
+struct xargs *xargs_new(char **argv)
+{
+  struct xargs *xa;
+  size_t len;
+  long n;
+  int i, j, fd;
+
+  xa = calloc(1, sizeof(*xa));
+  if (xa == NULL) {
+    printf("%s: out of memory\n", argv[0]);
+    return NULL;
+  }
+  xa->in = xa->out = -1;
+  xa->delim = -1;
+  xa->maxprocs = 1;
+  if (strcmp(argv[0], "parallel") == 0) {
+    xa->each = 1;
+    xa->maxargs = 1;
+    xa->delim = '\n';
+    xa->maxprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (xa->maxprocs < 1)
+      xa->maxprocs = 1;
+  }
+
+  for (i = 1; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (!xa->each && strcmp(argv[i], "-0") == 0) {
+      xa->delim = '\0';
+      continue;
+    }
+    if (argv[i + 1] == NULL)
+      goto usage;
+    if (xa->each && strcmp(argv[i], "--joblog") == 0) {
+      if (xa->joblog != NULL)
+        fclose(xa->joblog);
+      if ((xa->joblog = fopen(argv[i + 1], "we")) == NULL) {
+        printf("parallel: %s: %s\n", argv[i + 1], strerror(errno));
+        goto fail;
+      }
+      fprintf(xa->joblog, "Seq\tHost\tStarttime\tJobRuntime\tSend\tReceive\tExitval\tSignal\tCommand\n");
+      fflush(xa->joblog);
+    } else if (!xa->each && strcmp(argv[i], "-n") == 0) {
+      if ((xa->maxargs = number(xa, argv[i + 1], 1)) < 0)
+        goto fail;
+    } else if (strcmp(argv[i], xa->each ? "-j" : "-P") == 0) {
+      if ((n = number(xa, argv[i + 1], 0)) < 0)
+        goto fail;
+      xa->maxprocs = n;
+    } else {
+      goto usage;
+    }
+    i++;
+  }
+
+  for (n = 0; argv[i + n] != NULL; n++)
+    if (xa->each && (strcmp(argv[i + n], ":::") == 0 ||
+                     strcmp(argv[i + n], "::::") == 0))
+      break;
+  if (setcmd(xa, argv + i, n, xa->each ? NULL : "echo") < 0)
+    goto nomem;
+  if (argv[i += n] == NULL)
+    return xa;
+
+  if (strcmp(argv[i], ":::") == 0) {
+    /* the arguments, NUL-separated, as if read with -0 */
+    for (len = 0, j = i + 1; argv[j] != NULL; j++)
+      len += strlen(argv[j]) + 1;
+    if ((xa->buf = malloc(len + 1)) == NULL)
+      goto nomem;
+    for (len = 0, j = i + 1; argv[j] != NULL; j++) {
+      strcpy(xa->buf + len, argv[j]);
+      len += strlen(argv[j]) + 1;
+    }
+    xa->buf[len] = '\0';
+    xa->delim = '\0';
+  } else {
+    if (argv[i + 1] == NULL || argv[i + 2] != NULL)
+      goto usage;
+    if ((fd = open(argv[i + 1], O_RDONLY | O_CLOEXEC)) < 0) {
+      printf("parallel: %s: %s\n", argv[i + 1], strerror(errno));
+      goto fail;
+    }
+    j = readall(xa, fd, NULL, 0, &len);
+    close(fd);
+    if (j < 0)
+      goto fail;
+  }
+  if (cut(xa, len) < 0)
+    goto fail;
+  return xa;
+
+usage:
+  if (xa->each)
+    printf("parallel: usage: parallel [-j n] [--joblog file] [command [arg...]] [::: arg... | :::: file]\n");
+  else
+    printf("xargs: usage: xargs [-0] [-n max] [-P procs] [command [arg...]]\n");
+  goto fail;
+nomem:
+  printf("%s: out of memory\n", name(xa));
+fail:
+  xargs_free(xa);
+  return NULL;
+}
+
+/*
+ * readall - read all of fd into xa->buf, NUL-terminated, after the n
+ *    bytes at head that were already read from it. Returns -1 on an
+ *    error, or, with no message, if xa->wait gave the read up.
+ */
+static int readall(struct xargs *xa, int fd, const char *head, size_t n, size_t *lenp)
+{
+  size_t len = n, cap = 65536;
+  ssize_t r;
+  char *p;
+
+  while (cap <= len + 1)
+    cap *= 2;
+  if ((xa->buf = malloc(cap)) == NULL)
+    goto nomem;
+  if (n > 0)
+    memcpy(xa->buf, head, n);
+  for (;;) {
+    if (xa->wait != NULL && xa->wait(fd))
+      return -1;
+    if ((r = read(fd, xa->buf + len, cap - len - 1)) == 0)
+      break;
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      printf("%s: %s\n", name(xa), strerror(errno));
+      return -1;
+    }
+    len += r;
+    if (cap - len == 1) {
+      cap *= 2;
+      if ((p = realloc(xa->buf, cap)) == NULL)
+        goto nomem;
+      xa->buf = p;
+    }
+  }
+  xa->buf[len] = '\0';
+  *lenp = len;
+  return 0;
+
+nomem:
+  printf("%s: out of memory\n", name(xa));
+  return -1;
+}
+
+/*
+ * split - cut r..end into words in place the way POSIX xargs does, at
+ *    blanks and newlines, with quotes and backslashes. w never passes
+ *    r, so the words can be unquoted where they are. Returns how many
+ *    there are, or -1 (after a message) on an unmatched quote.
+ */
+static int split(struct xargs *xa, char *r, char *end, char **words)
+{
+  char *w = r, q;
+  int n = 0;
+
+  while (r < end) {
+    while (r < end && strchr(" \t\n", *r))
+      r++;
+    if (r == end)
+      break;
+    words[n++] = w;
+    while (r < end && !strchr(" \t\n", *r)) {
+      if (*r == '\'' || *r == '"') {
+        q = *r++;
+        while (r < end && *r != q && *r != '\n')
+          *w++ = *r++;
+        if (r == end || *r != q) {
+          printf("%s: unmatched %s quote\n", name(xa), q == '\'' ? "single" : "double");
+          return -1;
+        }
+        r++;
+      } else if (*r == '\\' && r + 1 < end) {
+        r++;
+        *w++ = *r++;
+      } else {
+        *w++ = *r++;
+      }
+    }
+    *w++ = '\0';
+    r++;
+  }
+  return n;
+}
+
+/* cut - cut the len bytes in xa->buf into items */
+static int cut(struct xargs *xa, size_t len)
+{
+  char *r, *end, *p;
+  int cap_items;
+
+  /* an item takes at least a byte and a separator, or just a separator */
+  cap_items = xa->delim >= 0 ? len + 1 : len / 2 + 1;
+  xa->items = malloc(cap_items * sizeof(char *));
+  xa->argv = malloc((xa->ncmd + cap_items + 2) * sizeof(char *));
+  if (xa->items == NULL || xa->argv == NULL) {
+    printf("%s: out of memory\n", name(xa));
+    return -1;
+  }
+
+  r = xa->buf;
+  end = xa->buf + len;
+  if (xa->delim < 0) {
+    xa->nitems = split(xa, r, end, xa->items);
+    return xa->nitems < 0 ? -1 : 0;
+  }
+  while (r < end) {
+    xa->items[xa->nitems++] = r;
+    if ((p = memchr(r, xa->delim, end - r)) == NULL)
+      p = end;
+    *p = '\0';
+    r = p + 1;
+  }
+  return 0;
+}
+
+/*
+ * xargs_read - read all of fd, after the n bytes at head that were
+ *    already read from it, and cut it into items, unless they are
+ *    already there. Returns -1 (after a message) on a read error or an
+ *    unmatched quote, or if xa->wait gave the read up.
+ */
+int xargs_read(struct xargs *xa, int fd, const char *head, size_t n)
+{
+  size_t len;
+
+  if (xa->items != NULL)
+    return 0;
+  if (readall(xa, fd, head, n, &len) < 0)
+    return -1;
+  return cut(xa, len);
+}
+
+/* monotonic - CLOCK_MONOTONIC, in ns */
+static long long monotonic(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* envsize - what the environment takes out of ARG_MAX */
+static long envsize(void)
+{
+  long size = sizeof(char *);
+  char **e;
+
+  for (e = environ; *e != NULL; e++)
+    size += strlen(*e) + 1 + sizeof(char *);
+  return size;
+}
+
+/* grow - make the batch's word buffer hold at least n bytes */
+static int grow(struct xargs *xa, size_t n)
+{
+  char *p;
+
+  if (n <= xa->linecap)
+    return 0;
+  if ((p = realloc(xa->line, n)) == NULL) {
+    printf("%s: out of memory\n", name(xa));
+    return -1;
+  }
+  xa->line = p;
+  xa->linecap = n;
+  return 0;
+}
+
+/* failure - count a parallel run that failed */
+static void failure(struct xargs *xa)
+{
+  xa->failed++;
+  xa->status = xa->failed < 101 ? xa->failed : 101;
+}
+
+/*
+ * eachbatch - parallel's next run: the command with {} replaced by the
+ *    next item (or the item appended), or the item's words if there is
+ *    no command
+ */
+static char **eachbatch(struct xargs *xa)
+{
+  const char *item, *s;
+  size_t len, need;
+  char *w;
+  int i, n, sub = 0;
+
+  for (;;) {
+    if (xa->stop || xa->next == xa->nitems)
+      return NULL;
+    item = xa->items[xa->next++];
+    xa->runs++;
+    len = strlen(item);
+    if (xa->ncmd > 0)
+      break;
+    if (grow(xa, len + 1) < 0)
+      return NULL;
+    memcpy(xa->line, item, len + 1);
+    if ((n = split(xa, xa->line, xa->line + len, xa->argv)) > 0) {
+      xa->argv[n] = NULL;
+      return xa->argv;
+    }
+    if (n < 0)
+      failure(xa);
+  }
+
+  for (need = 0, i = 0; i < xa->ncmd; i++) {
+    need += strlen(xa->cmd[i]) + 1;
+    for (s = xa->cmd[i]; (s = strstr(s, "{}")) != NULL; s += 2)
+      need += len;
+  }
+  if (grow(xa, need) < 0)
+    return NULL;
+  w = xa->line;
+  for (i = 0; i < xa->ncmd; i++) {
+    xa->argv[i] = w;
+    for (s = xa->cmd[i]; *s != '\0'; )
+      if (s[0] == '{' && s[1] == '}') {
+        memcpy(w, item, len);
+        w += len;
+        s += 2;
+        sub = 1;
+      } else {
+        *w++ = *s++;
+      }
+    *w++ = '\0';
+  }
+  n = xa->ncmd;
+  if (!sub)
+    xa->argv[n++] = (char *)item;
+  xa->argv[n] = NULL;
+  return xa->argv;
+}
+
+/*
+ * xargs_batch - the argv of the next batch: the command and as many of
+ *    the next items as -n and ARG_MAX allow. Valid until the next call.
+ *    NULL when there is nothing more to run. The command runs once even
+ *    with no items, as POSIX wants.
+ */
+char **xargs_batch(struct xargs *xa)
+{
+  long room = sysconf(_SC_ARG_MAX) - envsize() - HEADROOM, size;
+  int n = 0, i;
+
+  if (xa->each)
+    return eachbatch(xa);
+  if (xa->stop || (xa->next == xa->nitems && xa->runs > 0))
+    return NULL;
+  for (i = 0; i < xa->ncmd; i++) {
+    room -= strlen(xa->cmd[i]) + 1 + sizeof(char *);
+    xa->argv[n++] = xa->cmd[i];
+  }
+  for (i = xa->next; i < xa->nitems; i++) {
+    if (xa->maxargs > 0 && i - xa->next == xa->maxargs)
+      break;
+    size = strlen(xa->items[i]) + 1 + sizeof(char *);
+    if (size > room)
+      break;
+    room -= size;
+    xa->argv[n++] = xa->items[i];
+  }
+  if (i == xa->next && i < xa->nitems) {
+    printf("xargs: argument line too long\n");
+    xa->status = 1;
+    xa->stop = 1;
+    return NULL;
+  }
+  xa->argv[n] = NULL;
+  xa->next = i;
+  xa->runs++;
+  return xa->argv;
+}
+
+/*
+ * xargs_started - note that the batch xargs_batch just handed out is
+ *    running as pid, for its times and the joblog
+ */
+void xargs_started(struct xargs *xa, pid_t pid)
+{
+  struct xtask *t;
+  size_t len = 0;
+  char **a;
+
+  if (xa->ntasks == xa->taskcap) {
+    t = realloc(xa->tasks, (xa->taskcap * 2 + 4) * sizeof(*t));
+    if (t == NULL)
+      return;
+    xa->tasks = t;
+    xa->taskcap = xa->taskcap * 2 + 4;
+  }
+  t = &xa->tasks[xa->ntasks];
+  t->cmd = NULL;
+  if (xa->joblog != NULL) {
+    for (a = xa->argv; *a != NULL; a++)
+      len += strlen(*a) + 1;
+    if ((t->cmd = malloc(len + 1)) == NULL)
+      return;
+    t->cmd[0] = '\0';
+    for (a = xa->argv; *a != NULL; a++) {
+      strcat(t->cmd, *a);
+      if (a[1] != NULL)
+        strcat(t->cmd, " ");
+    }
+  }
+  t->pid = pid;
+  t->seq = xa->runs;
+  clock_gettime(CLOCK_REALTIME, &t->start);
+  t->t0 = monotonic();
+  xa->ntasks++;
+}
+
+/*
+ * taskdone - add the times of the run pid to the totals and the stats,
+ *    CPU time too if ru (from wait4) is given, write its joblog line
+ *    if there is a joblog, and forget it
+ */
+static void taskdone(struct xargs *xa, pid_t pid, int status, const struct rusage *ru)
+{
+  struct xtask *t;
+  long long wall, cpu;
+  int i;
+
+  for (i = 0; i < xa->ntasks && xa->tasks[i].pid != pid; i++)
+    ;
+  if (i == xa->ntasks)
+    return;
+  t = &xa->tasks[i];
+  wall = monotonic() - t->t0;
+  xa->timed++;
+  xa->wall += wall;
+  if (wall > xa->maxwall)
+    xa->maxwall = wall;
+  stats_add(PH_TASK, wall);
+  if (ru != NULL) {
+    cpu = (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000LL +
+          (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000LL;
+    xa->cpu += cpu;
+    stats_add(PH_TASKCPU, cpu);
+  }
+  if (xa->joblog != NULL && t->cmd != NULL) {
+    /* flushed line by line, so a forked run has nothing to write twice */
+    fprintf(xa->joblog, "%d\t:\t%lld.%03ld\t%8.3f\t0\t0\t%d\t%d\t%s\n",
+        t->seq, (long long)t->start.tv_sec, t->start.tv_nsec / 1000000,
+        wall / 1e9,
+        status == -1 ? 127 : WIFEXITED(status) ? WEXITSTATUS(status) : 0,
+        status != -1 && WIFSIGNALED(status) ? WTERMSIG(status) : 0, t->cmd);
+    fflush(xa->joblog);
+  }
+  free(t->cmd);
+  *t = xa->tasks[--xa->ntasks];
+}
+
+/*
+ * xargs_done - account for the batch pid that ended with wait status
+ *    status, or -1 if it could not be started (pid is 0 then). Like
+ *    POSIX xargs: 123 if any run failed, and 124 (exit 255), 125
+ *    (killed) or 126/127 (not run) stop the rest. parallel counts the
+ *    runs that failed and goes on, unless one got a SIGINT. ru is what
+ *    wait4 said the run used, or NULL.
+ */
+void xargs_done(struct xargs *xa, pid_t pid, int status, const struct rusage *ru)
+{
+  if (pid == 0)
+    xargs_started(xa, 0);
+  taskdone(xa, pid, status, ru);
+  if (!xa->each && status != 0)
+    xa->failed++;
+  if (xa->each) {
+    if (status != 0)
+      failure(xa);
+    /* ctrl-c reached the whole job, so it must not start more */
+    if (status != -1 && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+      xa->stop = 1;
+  } else if (status == -1) {
+    xa->status = 127;
+    xa->stop = 1;
+  } else if (WIFSIGNALED(status)) {
+    xa->status = 125;
+    xa->stop = 1;
+  } else if (WEXITSTATUS(status) == 255) {
+    xa->status = 124;
+    xa->stop = 1;
+  } else if (WEXITSTATUS(status) == 126 || WEXITSTATUS(status) == 127) {
+    xa->status = WEXITSTATUS(status);
+    xa->stop = 1;
+  } else if (WEXITSTATUS(status) != 0 && xa->status == 0) {
+    xa->status = 123;
+  }
+}
+
+/*
+ * xargs_summary - print, on one line, how many runs there were, their
+ *    wall time in total, on average and at most, and their CPU time
+ */
+void xargs_summary(struct xargs *xa)
+{
+  printf("%s: %d runs, %d failed, wall %.3fs (mean %.3fs, max %.3fs), cpu %.3fs\n",
+      name(xa), xa->timed, xa->failed, xa->wall / 1e9,
+      xa->timed ? xa->wall / 1e9 / xa->timed : 0.0, xa->maxwall / 1e9, xa->cpu / 1e9);
+}
+
+/* xargs_free - release xa and close its fds */
+void xargs_free(struct xargs *xa)
+{
+  int i;
+
+  if (xa->in >= 0)
+    close(xa->in);
+  if (xa->out >= 0)
+    close(xa->out);
+  if (xa->joblog != NULL)
+    fclose(xa->joblog);
+  for (i = 0; i < xa->ntasks; i++)
+    free(xa->tasks[i].cmd);
+  free(xa->tasks);
+  for (i = 0; xa->cmd != NULL && i < xa->ncmd; i++)
+    free(xa->cmd[i]);
+  free(xa->cmd);
+  free(xa->buf);
+  free(xa->items);
+  free(xa->argv);
+  free(xa->line);
+  free(xa);
+}
+
+/*
+ * xargs_main - xargs or parallel as a pipeline stage: fork the batches
+ *    and wait for them here. A builtin utility runs in the forked child.
+ */
+int xargs_main(char **argv)
+{
+  struct xargs *xa;
+  struct rusage ru;
+  builtin_t *fn;
+  char **batch;
+  int running = 0, status;
+  pid_t pid;
+
+  if ((xa = xargs_new(argv)) == NULL)
+    return 1;
+  if (xargs_read(xa, STDIN_FILENO, NULL, 0) < 0) {
+    xargs_free(xa);
+    return 1;
+  }
+  xa->in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+  for (;;) {
+    batch = NULL;
+    if (xa->maxprocs == 0 || running < xa->maxprocs)
+      batch = xargs_batch(xa);
+    if (batch == NULL) {
+      if (running == 0)
+        break;
+      if ((pid = wait4(-1, &status, 0, &ru)) < 0)
+        break;
+      running--;
+      xargs_done(xa, pid, status, &ru);
+      continue;
+    }
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+      printf("fork error: %s\n", strerror(errno));
+      xargs_done(xa, 0, -1, NULL);
+      continue;
+    }
+    if (pid == 0) {
+      if (xa->in >= 0)
+        dup2(xa->in, STDIN_FILENO);
+      if ((fn = builtin_find(batch[0])) != NULL)
+        exit(fn(batch));
+      execvp(batch[0], batch);
+      printf("command %s not found\n", batch[0]);
+      exit(127);
+    }
+    xargs_started(xa, pid);
+    running++;
+  }
+  status = xa->status;
+  xargs_free(xa);
+  return status;
+}
@@ -0,0 +1,76 @@
+#ifndef FILE_XARGS
+#define FILE_XARGS
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/*
+ * xargs [-0] [-n max] [-P procs] [command [arg...]]: run command (echo
+ * by default) with the words read from stdin appended, as many per run
+ * as ARG_MAX allows, and up to procs runs at once (0: no limit).
+ *
+ * parallel [-j n] [--joblog file] [command [arg...]] [::: arg... |
+ * :::: file]: run command once per argument, or per line of the file
+ * or of stdin, with {} in its words replaced by it (or it appended),
+ * keeping n runs going (the number of online CPUs by default). With no
+ * command, each line is a command of its own. The status is the number
+ * of runs that failed, up to 101, as with GNU parallel, and the joblog
+ * gets a line per run in GNU parallel's format. Either way the wall and
+ * CPU time of every run is added up, for xargs_summary, and goes to
+ * the task and taskcpu phases of the stats builtin.
+ *
+ * The shell runs a simple xargs or parallel command itself, so every
+ * run is a process of one job; in a pipeline, xargs_main forks and
+ * waits for the runs on its own. Either way the words are read up
+ * front, split the way POSIX xargs splits them (blanks and newlines,
+ * with quotes and backslashes), or at NULs with -0, or at newlines for
+ * parallel.
+ */
+struct xtask {              /* A run that has started */
+  pid_t pid;
+  int seq;
+  struct timespec start;    /* CLOCK_REALTIME */
+  long long t0;             /* CLOCK_MONOTONIC, in ns */
+  char *cmd;
+};
+
+struct xargs {
+  char **cmd;               /* command and initial arguments */
+  int ncmd;                 /* 0: each item is a command line */
+  long maxargs;             /* -n, or 0 for as many as fit */
+  int maxprocs;             /* -P or -j */
+  int delim;                /* item separator, or -1 for blanks */
+  int each;                 /* parallel: one run per item, {} replaced */
+  char *buf;                /* the input, cut into items in place */
+  char **items;
+  int nitems;
+  int next;                 /* first item not run yet */
+  int runs;                 /* batches handed out */
+  int failed;               /* runs that failed */
+  int timed;                /* runs that ended, with their times below */
+  long long wall, maxwall;  /* total and longest wall time, in ns */
+  long long cpu;            /* total user plus system CPU time, in ns */
+  char **argv;              /* the batch being handed out */
+  char *line;               /* its words, for each */
+  size_t linecap;
+  int status;               /* what xargs exits with */
+  int stop;                 /* run no more batches */
+  int in, out;              /* stdin and stdout of each batch, or -1 */
+  int (*wait)(int fd);      /* if set, called before a read; nonzero stops */
+  pid_t pgid;               /* process group the batches join */
+  FILE *joblog;             /* parallel --joblog, or NULL */
+  struct xtask *tasks;      /* runs going */
+  int ntasks, taskcap;
+};
+
+struct xargs *xargs_new(char **argv);
+int xargs_read(struct xargs *xa, int fd, const char *head, size_t n);
+char **xargs_batch(struct xargs *xa);
+void xargs_started(struct xargs *xa, pid_t pid);
+void xargs_done(struct xargs *xa, pid_t pid, int status, const struct rusage *ru);
+void xargs_summary(struct xargs *xa);
+void xargs_free(struct xargs *xa);
+int xargs_main(char **argv);
+#endif